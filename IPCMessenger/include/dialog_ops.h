@@ -12,11 +12,38 @@
 // Δημιουργια νεου διαλογου - επιστρεφει το ID
 int start_new_dialog(SharedMemoryData* memory);
 
-// Συμμετοχη σε υπαρχοντα διαλογο - επιστρεφει 0 αν επιτυχια, -1 αν αποτυχια
-int participate_in_dialog(SharedMemoryData* memory, int dialog_id);
+// Συμμετοχη σε υπαρχοντα διαλογο - επιστρεφει τη θεση του συμμετεχοντα (>= 0), -1 αν αποτυχια
+// Στο join_seq (αν δεν ειναι NULL) το seq του πρωτου μηνυματος που θα λαβει:
+// οτι ειναι πριν ειναι ιστορικο (journal), οχι νεο μηνυμα
+int participate_in_dialog(SharedMemoryData* memory, int dialog_id, unsigned long* join_seq);
+
+// Συμμετοχη σαν παρατηρητης (dialog_journal, dialog_bridge): ο διαλογος
+// κλεινει οταν φυγουν τα κανονικα μελη, οσο κι αν μενουν παρατηρητες
+int observe_dialog(SharedMemoryData* memory, int dialog_id);
+
+// Αποχωρηση απο διαλογο χωρις να σταλει TERMINATE
+void leave_dialog(SharedMemoryData* memory, int dialog_id);
+
+// Κλεισιμο διαλογου (καλειται μεσα στο lock)
+void release_dialog(SharedMemoryData* memory, DialogInfo* dialog);
 
 // Βοηθητικες συναρτησεις
 DialogInfo* get_dialog_by_id(SharedMemoryData* memory, int dialog_id);
 int find_participant_index(DialogInfo* dialog, pid_t pid);
 
+// Υπαρχει ενεργος συμμετεχων που δεν ειναι παρατηρητης;
+int dialog_has_members(const DialogInfo* dialog);
+
+// Εχουν διαβασει ολοι οι ενεργοι συμμετεχοντες το μηνυμα;
+int all_active_have_read(const DialogInfo* dialog, const MessageEntry* msg);
+
+// Ζει ακομα η διεργασια; (kill με σημα 0)
+int process_is_alive(pid_t pid);
+
+// Αποσυρει συμμετεχοντες που πεθαναν και ελευθερωνει τις θεσεις τους (μεσα στο lock)
+int reap_dead_participants(SharedMemoryData* memory);
+
+// Η θεση μου στον διαλογο απο την cache της διεργασιας (O(1) στο hot path)
+int my_participant_index(SharedMemoryData* memory, DialogInfo* dialog, pid_t pid);
+
 #endif
@@ -0,0 +1,86 @@
+/*
+ * journal.h - Μονιμη καταγραφη μηνυματων διαλογων σε αρχεια
+ *
+ * Καθε διαλογος εχει το δικο του append-only αρχειο. Τα μηνυματα
+ * μαζευονται σε buffer στη μνημη και γραφονται μαζι με ενα fdatasync
+ * (group commit), ωστε ο δισκος να μην μπαινει ποτε στο send_msg.
+ *
+ * Τα dialog IDs ξαναξεκινανε απο 1 οταν ξαναδημιουργειται το segment,
+ * γι' αυτο το αρχειο ξεκιναει με το instance_tag του segment: ενας writer
+ * απο αλλη εκτελεση το αδειαζει αντι να συνεχισει την παλια ιστορια.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "types.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// Ονομα αρχειου για καθε διαλογο μεσα στον φακελο του journal
+#define JOURNAL_FILE_FORMAT "%s/dialog_%d.journal"
+
+// Φακελος που χρησιμοποιειται αν δεν δοθει αλλος
+#define JOURNAL_DEFAULT_DIR "journal"
+
+// Αναγνωριστικο στην αρχη καθε αρχειου journal
+#define JOURNAL_MAGIC 0x4C4E524AU
+
+/*
+ * Κεφαλιδα του αρχειου
+ */
+typedef struct {
+    unsigned int magic;
+    unsigned int reserved;
+    unsigned long long instance_tag;  // του segment που το εγραψε
+} JournalFileHeader;
+
+/*
+ * Κεφαλιδα καθε εγγραφης στο αρχειο - ακολουθουν length bytes κειμενου
+ */
+typedef struct {
+    unsigned long seq;
+    int sender_pid;
+    unsigned int length;
+} JournalRecordHeader;
+
+/*
+ * Writer για ενα διαλογο
+ * Το pending γεμιζει απο τον receiver, το writing το κατεχει μονο
+ * οποιος κανει commit - ετσι το I/O γινεται χωρις να κρατιεται το lock.
+ */
+typedef struct {
+    int dialog_id;
+    int fd;
+    pthread_mutex_t lock;
+    char* pending;
+    size_t pending_len;
+    size_t pending_cap;
+    char* writing;
+    size_t writing_cap;
+} JournalWriter;
+
+// Ανοιγμα (η δημιουργια) του journal ενος διαλογου - 0 σε επιτυχια, -1 σε αποτυχια
+// Αν το αρχειο ανηκει σε αλλο instance_tag, αδειαζει πρωτα.
+int journal_open(JournalWriter* writer, const char* dir, int dialog_id,
+                 unsigned long long instance_tag);
+
+// Προσθηκη μηνυματος στο buffer (χωρις I/O) - 0 σε επιτυχια, -1 σε αποτυχια
+int journal_append(JournalWriter* writer, const ReceivedMessage* msg);
+
+// Εγγραφη ολων των εκκρεμων μηνυματων με ενα fdatasync - 0 σε επιτυχια
+int journal_commit(JournalWriter* writer);
+
+// Τελικο commit και κλεισιμο
+void journal_close(JournalWriter* writer);
+
+// Callback για καθε μηνυμα που διαβαζεται στο replay
+typedef void (*JournalReplayFn)(const ReceivedMessage* msg, void* ctx);
+
+// Επαναληψη μηνυματων με from_seq <= seq < until_seq (until_seq 0 = χωρις οριο)
+// - επιστρεφει ποσα βρεθηκαν, -1 αν δεν υπαρχει journal
+// instance_tag: μονο αν το journal ειναι αυτης της εκτελεσης (0 = οποιασδηποτε)
+long journal_replay(const char* dir, int dialog_id, unsigned long from_seq, unsigned long until_seq,
+                    unsigned long long instance_tag, JournalReplayFn callback, void* ctx);
+
+#endif
@@ -12,7 +12,15 @@
 // Αποστολη μηνυματος σε διαλογο
 int send_msg(SharedMemoryData* memory, int dialog_id, const char* message_text);
 
-// Ληψη νεων μηνυματων - επιστρεφει 1 αν ελαβε TERMINATE, 0 αλλιως
-int check_and_receive_messages(SharedMemoryData* memory, int dialog_id);
+// Ληψη νεων μηνυματων - επιστρεφει 1 αν ελαβε TERMINATE (η ο διαλογος εκλεισε), 0 αλλιως
+// Μηνυματα με seq < from_seq (το ιστορικο που ειδε ηδη ο χρηστης) δεν εμφανιζονται
+int check_and_receive_messages(SharedMemoryData* memory, int dialog_id, unsigned long from_seq);
+
+// Μαζικη αποστολη - ενα lock για ολα, επιστρεφει ποσα σταλθηκαν η -1
+int send_msgs(SharedMemoryData* memory, int dialog_id, const char* const msgs[], int count);
+
+// Μαζικη ληψη στον πινακα out - επιστρεφει ποσα μηνυματα αντιγραφηκαν,
+// -1 αν ο διαλογος δεν υπαρχει πια η δεν συμμετεχω
+int receive_msgs(SharedMemoryData* memory, int dialog_id, ReceivedMessage out[], int max_count);
 
 #endif
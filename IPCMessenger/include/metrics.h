@@ -0,0 +1,28 @@
+/*
+ * metrics.h - Μετρησεις του segment (βλ. Metrics στο types.h)
+ * 
+ * Ολες οι συναρτησεις ενημερωσης καλουνται μεσα στο lock.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "types.h"
+
+// Τρεχων χρονος σε ns (CLOCK_MONOTONIC)
+unsigned long long metrics_now_ns(void);
+
+// Μηδενισμος των μετρησεων ενος slot διαλογου για νεο διαλογο
+void metrics_reset_dialog(SharedMemoryData* memory, int slot, int dialog_id);
+
+// Ενα μηνυμα μπηκε / βγηκε απο την ουρα
+void metrics_queue_push(SharedMemoryData* memory);
+void metrics_queue_pop(SharedMemoryData* memory);
+
+// Καταγραφη χρονου παραδοσης στο ιστογραμμα του διαλογου
+void metrics_record_latency(DialogMetrics* dialog, unsigned long long latency_ns);
+
+// Ανω οριο (ns) του bucket οπου πεφτει το ποσοστημοριο p (0..1) - 0 αν δεν υπαρχουν δειγματα
+unsigned long long metrics_latency_percentile(const DialogMetrics* dialog, double p);
+
+#endif
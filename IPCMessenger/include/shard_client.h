@@ -0,0 +1,40 @@
+/*
+ * shard_client.h - Κατανομη διαλογων σε πολλα ανεξαρτητα συστηματα
+ * 
+ * Καθε shard ειναι ενα δικο του namespace (segment + lock), οποτε
+ * διαλογοι σε διαφορετικα shards δεν ανταγωνιζονται για το ιδιο lock.
+ * Το global ID ενος διαλογου κωδικοποιει το shard του:
+ *     global_id = local_id * shard_count + shard
+ */
+
+#ifndef SHARD_CLIENT_H
+#define SHARD_CLIENT_H
+
+#include "types.h"
+#include "shm_manager.h"
+
+// Μεγιστος αριθμος shards
+#define MAX_SHARDS 8
+
+typedef struct {
+    int shard_count;
+    ShmNamespace namespaces[MAX_SHARDS];
+    SharedMemoryData* shards[MAX_SHARDS];
+    int next_shard;  // round-robin για νεους διαλογους
+} ShardClient;
+
+// Συνδεση σε shard_count shards με βαση το base (NULL = προεπιλεγμενο) - 0 σε επιτυχια
+int shard_client_connect(ShardClient* client, const ShmNamespace* base, int shard_count, int should_create);
+void shard_client_disconnect(ShardClient* client);
+void shard_client_cleanup(ShardClient* client);
+
+// Σε ποιο shard και με ποιο τοπικο ID βρισκεται ενας διαλογος
+SharedMemoryData* shard_for_dialog(ShardClient* client, int global_id, int* local_id);
+
+// Οι λειτουργιες διαλογων/μηνυματων με global IDs
+int shard_start_new_dialog(ShardClient* client);
+int shard_participate_in_dialog(ShardClient* client, int global_id);
+int shard_send_msgs(ShardClient* client, int global_id, const char* const msgs[], int count);
+int shard_receive_msgs(ShardClient* client, int global_id, ReceivedMessage out[], int max_count);
+
+#endif
@@ -10,13 +10,44 @@
 
 #include "types.h"
 
-// Συναρτησεις για τη διαχειριση της shared memory
-SharedMemoryData* connect_to_shared_memory(int should_create);
+// Μεγεθος ονοματος semaphore στο namespace
+#define SHM_SEM_NAME_SIZE 64
+
+/*
+ * Ενα ανεξαρτητο συστημα μηνυματων: segment (key) και lock (semaphore)
+ */
+typedef struct {
+    int key;  // System V key του segment
+    char sem_name[SHM_SEM_NAME_SIZE];
+} ShmNamespace;
+
+// Προεπιλεγμενο namespace (DIALOG_SHM_KEY / DIALOG_SEM_NAME η τα σταθερα)
+void default_namespace(ShmNamespace* ns);
+
+// Namespace του shard index με βαση το base (το shard 0 ειναι το base)
+void shard_namespace(ShmNamespace* ns, const ShmNamespace* base, int index);
+
+// Συναρτησεις για τη διαχειριση της shared memory (ns == NULL: προεπιλεγμενο)
+SharedMemoryData* connect_to_shared_memory(const ShmNamespace* ns, int should_create);
 void disconnect_from_shared_memory(SharedMemoryData* mem_ptr);
-void cleanup_shared_memory(void);
+void cleanup_shared_memory(const ShmNamespace* ns);
+const ShmNamespace* namespace_of(const SharedMemoryData* memory);
+
+// Συναρτησεις για locking (critical sections) - καθε segment εχει δικο του lock
+void lock_memory(SharedMemoryData* memory);
+void unlock_memory(SharedMemoryData* memory);
+
+/*
+ * Στατιστικα του lock για την τρεχουσα διεργασια
+ * Μετρανε μονο οταν γινεται compile με -DIPC_LOCK_STATS (βλ. make bench),
+ * αλλιως μενουν μηδεν για να μην πληρωνει το clock_gettime το κανονικο build.
+ */
+typedef struct {
+    unsigned long acquisitions;
+    unsigned long long wait_ns;  // χρονος αναμονης στο sem_wait
+    unsigned long long hold_ns;  // χρονος μεσα στο critical section
+} LockStats;
 
-// Συναρτησεις για locking (critical sections)
-void lock_memory(void);
-void unlock_memory(void);
+void get_lock_stats(LockStats* out);
 
 #endif
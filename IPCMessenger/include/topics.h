@@ -0,0 +1,31 @@
+/*
+ * topics.h - Publish/subscribe με κοινο log και cursor ανα συνδρομητη
+ * 
+ * Σε αντιθεση με τους διαλογους, ενα μηνυμα topic γραφεται μια φορα
+ * και καθε συνδρομητης απλα προχωραει το δικο του cursor. Η διατηρηση
+ * ακολουθει το μικροτερο cursor, αρα το κοστος ενος μηνυματος δεν
+ * εξαρταται απο τον αριθμο των συνδρομητων.
+ */
+
+#ifndef TOPICS_H
+#define TOPICS_H
+
+#include "types.h"
+
+// Δημιουργια νεου topic - επιστρεφει το ID η -1
+int topic_create(SharedMemoryData* memory);
+
+// Κλεισιμο topic (αποσυρονται και οι συνδρομητες του)
+void topic_close(SharedMemoryData* memory, int topic_id);
+
+// Εγγραφη συνδρομητη απο το επομενο μηνυμα - επιστρεφει handle η -1
+int topic_subscribe(SharedMemoryData* memory, int topic_id);
+void topic_unsubscribe(SharedMemoryData* memory, int subscription);
+
+// Δημοσιευση - επιστρεφει ποσα μηνυματα γραφτηκαν (λιγοτερα αν γεμισε το log), -1 αν δεν υπαρχει το topic
+int topic_publish(SharedMemoryData* memory, int topic_id, const char* const msgs[], int count);
+
+// Ληψη μεχρι max_count μηνυματων απο το cursor μου - επιστρεφει ποσα, -1 αν το handle δεν ισχυει
+int topic_receive(SharedMemoryData* memory, int subscription, ReceivedMessage out[], int max_count);
+
+#endif
@@ -16,12 +16,27 @@
 #define MAX_MSGS_IN_QUEUE 100
 #define MSG_TEXT_SIZE 256
 
+// Πινακας κατακερματισμου dialog ID -> θεση (δυναμη του 2, τουλαχιστον 2*MAX_DIALOGS)
+#define DIALOG_HASH_SIZE 32
+#define DIALOG_HASH_EMPTY -1
+
+// Ορια για τα topics (publish/subscribe)
+#define MAX_TOPICS 8
+#define TOPIC_LOG_SIZE 256
+#define MAX_SUBSCRIBERS 1024
+
+// Μετρησεις: buckets του ιστογραμματος (bucket i = [2^i, 2^(i+1)) ns)
+#define LATENCY_BUCKETS 32
+// Ο χρονος αναμονης του lock μετριεται σε 1 στα τοσα κλειδωματα
+#define LOCK_WAIT_SAMPLE_EVERY 16
+
 /*
  * Καθε συμμετεχων σε διαλογο εχει ενα PID και μια κατασταση
  */
 typedef struct {
     pid_t process_id;
     int is_active;  // 1 = ενεργος, 0 = εχει φυγει
+    int is_observer;  // 1 = journal/bridge: διαβαζει, αλλα δεν κραταει τον διαλογο ανοιχτο
 } Participant;
 
 /*
@@ -35,31 +50,113 @@ typedef struct {
     int active;  // 0 = κενη θεση, 1 = ενεργος διαλογος
     Participant participants[MAX_PARTICIPANTS];
     int participant_count;
+    unsigned long next_seq;  // αυξων αριθμος για το επομενο μηνυμα (ξεκιναει απο 1)
 } DialogInfo;
 
 /*
  * Ενα μηνυμα στο συστημα περιεχει:
  * - το ID του διαλογου στον οποιο ανηκει
  * - τον αποστολεα (PID)
+ * - τον αυξοντα αριθμο του
  * - το κειμενο
  * - πινακα με το ποιοι το εχουν διαβασει
  */
 typedef struct {
     int belongs_to_dialog;
     pid_t sender_pid;
+    unsigned long seq;  // αυξων αριθμος μεσα στον διαλογο (για το journal)
+    unsigned long long sent_ns;  // χρονος αποστολης (CLOCK_MONOTONIC) για το latency
     char text[MSG_TEXT_SIZE];
     int occupied;  // 0 = ελευθερη θεση, 1 = υπαρχει μηνυμα
     int has_been_read[MAX_PARTICIPANTS];  // ποιος συμμετεχων το διαβασε
 } MessageEntry;
 
+/*
+ * Αντιγραφο μηνυματος που επιστρεφεται στον καλουντα απο το receive_msgs
+ * (ετσι η εκτυπωση γινεται εξω απο το critical section)
+ */
+typedef struct {
+    pid_t sender_pid;
+    unsigned long seq;
+    char text[MSG_TEXT_SIZE];
+} ReceivedMessage;
+
+/*
+ * Μια εγγραφη στο log ενος topic - γραφεται μια φορα και δεν εχει
+ * καμια πληροφορια για το ποιος τη διαβασε
+ */
+typedef struct {
+    unsigned long seq;
+    pid_t sender_pid;
+    char text[MSG_TEXT_SIZE];
+} TopicEntry;
+
+/*
+ * Ενα topic ειναι ενας κυκλικος buffer με δυο μετρητες:
+ * - head: το seq του επομενου μηνυματος που θα γραφτει
+ * - tail: το παλαιοτερο seq που κραταμε (ακολουθει το μικροτερο cursor)
+ */
+typedef struct {
+    int topic_id;
+    int active;
+    unsigned long head;
+    unsigned long tail;
+    int subscriber_count;
+    TopicEntry log[TOPIC_LOG_SIZE];
+} TopicInfo;
+
+/*
+ * Ενας συνδρομητης - μονο ενα cursor, οχι κατασταση ανα μηνυμα
+ */
+typedef struct {
+    int in_use;
+    int topic_slot;
+    int topic_id;  // για να μη διαβαζει απο νεο topic στο ιδιο slot
+    pid_t process_id;
+    unsigned long cursor;  // το seq του επομενου μηνυματος που θα διαβασει
+} Subscriber;
+
+/*
+ * Μετρησεις ενος διαλογου - ανα slot του all_dialogs,
+ * μηδενιζονται οταν το slot παιρνει νεο διαλογο
+ */
+typedef struct {
+    int dialog_id;
+    unsigned long sent;
+    unsigned long delivered;   // μια παραδοση ανα αναγνωστη
+    unsigned long queue_full;  // αποστολες που απετυχαν λογω γεματης ουρας
+    unsigned long latency[LATENCY_BUCKETS];  // send -> receive
+} DialogMetrics;
+
+/*
+ * Μετρησεις ολου του segment
+ * Γραφονται μονο μεσα στο lock, αλλα το dialog_stat τις διαβαζει χωρις
+ * lock - ειναι μονο μετρητες, οποτε ενα ελαχιστα παλιο snapshot αρκει.
+ */
+typedef struct {
+    unsigned long lock_acquisitions;
+    unsigned long lock_wait_samples;
+    unsigned long long lock_wait_ns;  // αθροισμα στα δειγματα
+    unsigned long long lock_wait_max_ns;
+    int queue_depth;
+    int queue_high_water;
+    DialogMetrics dialogs[MAX_DIALOGS];
+} Metrics;
+
 /*
  * Η κυρια δομη της shared memory
- * Περιεχει ολους τους διαλογους και ολα τα μηνυματα
+ * Περιεχει ολους τους διαλογους και ολα τα μηνυματα, καθως και τα topics
  */
 typedef struct {
     DialogInfo all_dialogs[MAX_DIALOGS];
     MessageEntry message_queue[MAX_MSGS_IN_QUEUE];
     int next_available_id;  // για τη δημιουργια νεων dialog IDs
+    int dialog_hash[DIALOG_HASH_SIZE];  // dialog ID -> θεση στο all_dialogs (linear probing)
+    TopicInfo all_topics[MAX_TOPICS];
+    Subscriber subscribers[MAX_SUBSCRIBERS];
+    int next_topic_generation;  // για τη δημιουργια νεων topic IDs
+    Metrics metrics;  // βλ. dialog_stat
+    unsigned long long instance_tag;  // αλλαζει σε καθε δημιουργια του segment (βλ. journal)
 } SharedMemoryData;
 
 #endif
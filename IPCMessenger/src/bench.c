@@ -0,0 +1,395 @@
+/*
+ * bench.c - Μετρηση αποδοσης του transport της shared memory
+ *
+ * Κανει fork N producers και M consumers πανω στους ιδιους διαλογους
+ * και μετραει:
+ *   - ρυθμο μηνυματων (msgs/sec)
+ *   - end-to-end latency απο το timestamp που γραφεται μεσα στο μηνυμα
+ *   - χρονο αναμονης και κρατησης του lock (απαιτει -DIPC_LOCK_STATS)
+ *
+ * Χρηση: ipc_bench [-p producers] [-c consumers] [-d dialogs]
+ *                  [-n msgs_per_producer] [-s msg_size] [-b batch] [-S shards] [-t] [-P]
+ *
+ * Με -t χρησιμοποιουνται topics (publish/subscribe) αντι για διαλογους,
+ * οποτε οι consumers μπορουν να ειναι πολυ περισσοτεροι (fan-out).
+ * Με -S οι διαλογοι μοιραζονται σε ανεξαρτητα segments (shard_client.c),
+ * ωστε να φαινεται ποσο κοστιζει το ενα κοινο lock.
+ *
+ * Καθε εκτελεση δουλευει σε δικο της segment (key απο το PID) και το
+ * καταστρεφει στο τελος. Με -P χρησιμοποιει το προεπιλεγμενο namespace
+ * (DIALOG_SHM_KEY / DIALOG_SEM_NAME) - ΠΡΟΣΟΧΗ: τοτε το shard 0 ειναι το
+ * segment του dialog_system και οι πραγματικοι διαλογοι του χανονται.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "types.h"
+#include "shm_manager.h"
+#include "dialog_ops.h"
+#include "messaging.h"
+#include "shard_client.h"
+#include "topics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define RECV_BATCH 32
+#define MAX_SEND_BATCH 64
+#define CONSUMER_TIMEOUT_SEC 60
+
+// Βαση για τα ιδιωτικα keys (+ PID) - μακρια απο το 0x5A7B του dialog_system
+#define BENCH_KEY_BASE 0x1B000000
+
+// 1 = topics αντι για διαλογους (το dialog_id ειναι topic ID / handle συνδρομης)
+static int topic_mode = 0;
+
+/*
+ * Αποτελεσματα καθε παιδιου - γραφονται σε κοινη (MAP_SHARED) μνημη
+ */
+typedef struct {
+    long delivered;
+    LockStats lock;
+} ChildResult;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*) a;
+    unsigned long long y = *(const unsigned long long*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Περιμενει το σημα εκκινησης - ο γονιος κλεινει το write end του pipe
+ */
+static void wait_for_start(int go_fd) {
+    char c;
+    while (read(go_fd, &c, 1) > 0) {
+    }
+}
+
+/*
+ * Producer: στελνει msgs_count μηνυματα με timestamp στην αρχη του κειμενου
+ */
+static void run_producer(ShardClient* client, int dialog_id, long msgs_count,
+                         int msg_size, int batch, int go_fd, ChildResult* result) {
+    static char texts[MAX_SEND_BATCH][MSG_TEXT_SIZE];
+    const char* ptrs[MAX_SEND_BATCH];
+
+    for (int i = 0; i < batch; i++) {
+        memset(texts[i], 'x', msg_size);
+        texts[i][msg_size] = '\0';
+        ptrs[i] = texts[i];
+    }
+
+    wait_for_start(go_fd);
+
+    long sent = 0;
+    while (sent < msgs_count) {
+        int count = batch;
+        if (msgs_count - sent < count) {
+            count = (int) (msgs_count - sent);
+        }
+
+        // Το timestamp μπαινει μπροστα, το υπολοιπο μενει padding
+        unsigned long long stamp = now_ns();
+        for (int i = 0; i < count; i++) {
+            int len = snprintf(texts[i], MSG_TEXT_SIZE, "%llu", stamp);
+            if (len < msg_size) {
+                texts[i][len] = ' ';
+            }
+        }
+
+        int offset = 0;
+        while (offset < count) {
+            int done = topic_mode
+                ? topic_publish(client->shards[0], dialog_id, &ptrs[offset], count - offset)
+                : shard_send_msgs(client, dialog_id, &ptrs[offset], count - offset);
+            if (done > 0) {
+                offset += done;
+            } else {
+                sched_yield();
+            }
+        }
+        sent += count;
+    }
+
+    result->delivered = sent;
+    get_lock_stats(&result->lock);
+}
+
+/*
+ * Consumer: διαβαζει expected μηνυματα και καταγραφει το latency του καθενος
+ */
+static void run_consumer(ShardClient* client, int dialog_id, long expected,
+                         unsigned long long* latencies, int go_fd, ChildResult* result) {
+    ReceivedMessage batch[RECV_BATCH];
+    long received = 0;
+
+    wait_for_start(go_fd);
+
+    unsigned long long deadline = now_ns() + CONSUMER_TIMEOUT_SEC * 1000000000ULL;
+
+    while (received < expected) {
+        int count = topic_mode
+            ? topic_receive(client->shards[0], dialog_id, batch, RECV_BATCH)
+            : shard_receive_msgs(client, dialog_id, batch, RECV_BATCH);
+        unsigned long long arrived = now_ns();
+
+        if (count < 0) {
+            fprintf(stderr, "consumer %d: αποτυχια ληψης (%ld/%ld)\n",
+                    (int) getpid(), received, expected);
+            break;
+        }
+
+        for (int i = 0; i < count && received < expected; i++) {
+            unsigned long long stamp = strtoull(batch[i].text, NULL, 10);
+            latencies[received++] = arrived - stamp;
+        }
+
+        if (count == 0) {
+            if (arrived > deadline) {
+                fprintf(stderr, "consumer %d: timeout (%ld/%ld)\n",
+                        (int) getpid(), received, expected);
+                break;
+            }
+            sched_yield();
+        }
+    }
+
+    result->delivered = received;
+    get_lock_stats(&result->lock);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Χρηση: %s [-p producers] [-c consumers] [-d dialogs]\n"
+            "          [-n msgs_per_producer] [-s msg_size] [-b batch] [-S shards] [-t] [-P]\n"
+            "  -P  χρηση του segment του dialog_system (καταστρεφεται στο τελος!)\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int producers = 1;
+    int consumers = 1;
+    int dialogs = 1;
+    long msgs_per_producer = 100000;
+    int msg_size = 64;
+    int batch = 1;
+    int shards = 1;
+    int use_default_ns = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:d:n:s:b:S:tPh")) != -1) {
+        switch (opt) {
+            case 'p': producers = atoi(optarg); break;
+            case 'c': consumers = atoi(optarg); break;
+            case 'd': dialogs = atoi(optarg); break;
+            case 'n': msgs_per_producer = atol(optarg); break;
+            case 's': msg_size = atoi(optarg); break;
+            case 'b': batch = atoi(optarg); break;
+            case 'S': shards = atoi(optarg); break;
+            case 't': topic_mode = 1; break;
+            case 'P': use_default_ns = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    // Ελεγχος οριων - ο γονιος πιανει τη θεση 0 σε καθε διαλογο
+    int max_per_dialog = topic_mode ? MAX_SUBSCRIBERS : MAX_PARTICIPANTS - 1;
+    int max_dialogs = topic_mode ? MAX_TOPICS : MAX_DIALOGS * shards;
+    if (shards < 1 || shards > MAX_SHARDS || (topic_mode && shards != 1) ||
+        producers < 1 || dialogs < 1 || dialogs > max_dialogs || consumers < dialogs ||
+        (consumers + dialogs - 1) / dialogs > max_per_dialog ||
+        msgs_per_producer < 1 || msg_size < 24 || msg_size >= MSG_TEXT_SIZE ||
+        batch < 1 || batch > MAX_SEND_BATCH) {
+        fprintf(stderr, "Μη εγκυρες παραμετροι (shards <= %d, χωρις shards με -t, dialogs <= %d, "
+                "dialogs <= consumers <= %d*dialogs, 24 <= size < %d, batch <= %d)\n",
+                MAX_SHARDS, max_dialogs, max_per_dialog, MSG_TEXT_SIZE, MAX_SEND_BATCH);
+        return 1;
+    }
+
+    // Ιδιωτικο namespace, εκτος αν ζητηθει ρητα το κανονικο
+    ShmNamespace base;
+    if (use_default_ns) {
+        default_namespace(&base);
+    } else {
+        base.key = BENCH_KEY_BASE + (int) getpid();
+        snprintf(base.sem_name, sizeof(base.sem_name), "/ipc_bench_%d", (int) getpid());
+    }
+
+    ShardClient client;
+    if (shard_client_connect(&client, &base, shards, 1) < 0) {
+        return 1;
+    }
+
+    // Δημιουργια διαλογων - ο γονιος δεν διαβαζει, αρα γινεται αμεσως ανενεργος
+    int dialog_ids[MAX_DIALOGS * MAX_SHARDS];
+    for (int d = 0; d < dialogs && topic_mode; d++) {
+        dialog_ids[d] = topic_create(client.shards[0]);
+        if (dialog_ids[d] < 0) {
+            shard_client_cleanup(&client);
+            return 1;
+        }
+    }
+    for (int d = 0; d < dialogs && !topic_mode; d++) {
+        dialog_ids[d] = shard_start_new_dialog(&client);
+        if (dialog_ids[d] < 0) {
+            shard_client_cleanup(&client);
+            return 1;
+        }
+        int local_id;
+        SharedMemoryData* memory = shard_for_dialog(&client, dialog_ids[d], &local_id);
+        lock_memory(memory);
+        get_dialog_by_id(memory, local_id)->participants[0].is_active = 0;
+        unlock_memory(memory);
+    }
+
+    // Producers και consumers μοιραζονται round-robin στους διαλογους
+    long per_dialog_msgs[MAX_DIALOGS * MAX_SHARDS] = { 0 };
+    for (int p = 0; p < producers; p++) {
+        per_dialog_msgs[p % dialogs] += msgs_per_producer;
+    }
+
+    long total_deliveries = 0;
+    for (int c = 0; c < consumers; c++) {
+        total_deliveries += per_dialog_msgs[c % dialogs];
+    }
+
+    int children = producers + consumers;
+    ChildResult* results = mmap(NULL, sizeof(ChildResult) * children, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    unsigned long long* latencies = mmap(NULL, sizeof(unsigned long long) * total_deliveries,
+                                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED || latencies == MAP_FAILED) {
+        perror("Αποτυχια mmap");
+        shard_client_cleanup(&client);
+        return 1;
+    }
+    memset(results, 0, sizeof(ChildResult) * children);
+
+    int go_pipe[2];
+    int ready_pipe[2];
+    if (pipe(go_pipe) < 0 || pipe(ready_pipe) < 0) {
+        perror("Αποτυχια pipe");
+        shard_client_cleanup(&client);
+        return 1;
+    }
+
+    // Οι consumers πρεπει να εχουν μπει στον διαλογο πριν σταλει οτιδηποτε
+    long latency_offset = 0;
+    for (int c = 0; c < consumers; c++) {
+        int dialog_index = c % dialogs;
+        long expected = per_dialog_msgs[dialog_index];
+        unsigned long long* slice = latencies + latency_offset;
+        latency_offset += expected;
+
+        if (fork() == 0) {
+            close(go_pipe[1]);
+            close(ready_pipe[0]);
+            int handle = topic_mode
+                ? topic_subscribe(client.shards[0], dialog_ids[dialog_index])
+                : shard_participate_in_dialog(&client, dialog_ids[dialog_index]);
+            if (handle < 0) {
+                _exit(1);
+            }
+            if (write(ready_pipe[1], "r", 1) != 1) {
+                _exit(1);
+            }
+            close(ready_pipe[1]);
+            run_consumer(&client, topic_mode ? handle : dialog_ids[dialog_index], expected, slice,
+                         go_pipe[0], &results[producers + c]);
+            _exit(0);
+        }
+    }
+
+    close(ready_pipe[1]);
+    int joined = 0;
+    char c;
+    while (joined < consumers && read(ready_pipe[0], &c, 1) == 1) {
+        joined++;
+    }
+    close(ready_pipe[0]);
+
+    if (joined < consumers) {
+        fprintf(stderr, "Αποτυχια συμμετοχης consumers (%d/%d)\n", joined, consumers);
+        close(go_pipe[1]);
+        while (wait(NULL) > 0) {
+        }
+        shard_client_cleanup(&client);
+        return 1;
+    }
+
+    for (int p = 0; p < producers; p++) {
+        if (fork() == 0) {
+            close(go_pipe[1]);
+            run_producer(&client, dialog_ids[p % dialogs], msgs_per_producer, msg_size, batch,
+                         go_pipe[0], &results[p]);
+            _exit(0);
+        }
+    }
+
+    // Εκκινηση ολων ταυτοχρονα
+    unsigned long long start = now_ns();
+    close(go_pipe[1]);
+
+    while (wait(NULL) > 0) {
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    // Συγκεντρωση αποτελεσματων
+    long sent = 0;
+    long delivered = 0;
+    LockStats lock = { 0, 0, 0 };
+    for (int i = 0; i < children; i++) {
+        if (i < producers) {
+            sent += results[i].delivered;
+        } else {
+            delivered += results[i].delivered;
+        }
+        lock.acquisitions += results[i].lock.acquisitions;
+        lock.wait_ns += results[i].lock.wait_ns;
+        lock.hold_ns += results[i].lock.hold_ns;
+    }
+
+    qsort(latencies, delivered == total_deliveries ? total_deliveries : 0,
+          sizeof(unsigned long long), compare_u64);
+
+    printf("producers=%-2d consumers=%-2d %s=%-2d shards=%d size=%-3d batch=%-2d | "
+           "%10.0f msgs/s %10.0f deliveries/s | ",
+           producers, consumers, topic_mode ? "topics " : "dialogs", dialogs, shards, msg_size, batch,
+           sent / elapsed, delivered / elapsed);
+
+    if (delivered == total_deliveries) {
+        printf("latency us p50=%.1f p90=%.1f p99=%.1f max=%.1f | ",
+               latencies[total_deliveries / 2] / 1e3,
+               latencies[total_deliveries * 90 / 100] / 1e3,
+               latencies[total_deliveries * 99 / 100] / 1e3,
+               latencies[total_deliveries - 1] / 1e3);
+    } else {
+        printf("latency n/a (%ld/%ld delivered) | ", delivered, total_deliveries);
+    }
+
+    if (lock.acquisitions > 0) {
+        printf("lock acq=%lu hold=%.0fns wait=%.0fns\n", lock.acquisitions,
+               (double) lock.hold_ns / lock.acquisitions,
+               (double) lock.wait_ns / lock.acquisitions);
+    } else {
+        printf("lock stats n/a (build with -DIPC_LOCK_STATS)\n");
+    }
+
+    munmap(latencies, sizeof(unsigned long long) * total_deliveries);
+    munmap(results, sizeof(ChildResult) * children);
+    shard_client_disconnect(&client);
+    shard_client_cleanup(&client);
+
+    return delivered == total_deliveries ? 0 : 1;
+}
@@ -0,0 +1,476 @@
+/*
+ * bridge.c - Γεφυρα διαλογων μεταξυ δυο segments μεσω TCP
+ *
+ * Χρηση: dialog_bridge (-l port | -c host:port) -d local_id:remote_id ...
+ *
+ * Η γεφυρα συμμετεχει σε καθε τοπικο διαλογο σαν παρατηρητης (οταν
+ * φυγουν τα τοπικα μελη ο διαλογος κλεινει κανονικα), στελνει
+ * τα μηνυματα στο peer σε frames και βαζει οσα ερχονται απο το peer
+ * στον αντιστοιχο τοπικο διαλογο με send_msgs. Ολο το I/O ειναι
+ * non-blocking με epoll.
+ *
+ * Τα μηνυματα που βαζει η γεφυρα στον τοπικο διαλογο εχουν ως αποστολεα
+ * το PID της γεφυρας - το PID του αρχικου αποστολεα δεν μεταφερεται
+ * (ειναι PID αλλου host/namespace και δεν χωραει στο reserved πεδιο).
+ *
+ * Backpressure:
+ *   - αν το socket δεν προλαβαινει, σταματαει το διαβασμα της ουρας
+ *     και γεμιζει η τοπικη ουρα (οι αποστολεις βλεπουν "γεματη")
+ *   - αν η τοπικη ουρα ειναι γεματη, σταματαει το διαβασμα του socket
+ *     και το TCP window φρεναρει το peer
+ *
+ * Δοκιμη σε ενα host με δυο ανεξαρτητα segments:
+ *   DIALOG_SHM_KEY=0x5A7C DIALOG_SEM_NAME=/dialog_sem_b ./dialog_bridge -l 7000 -d 1:1
+ *   ./dialog_bridge -c 127.0.0.1:7000 -d 1:1
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "types.h"
+#include "shm_manager.h"
+#include "dialog_ops.h"
+#include "messaging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define RECEIVE_BATCH 32
+#define POLL_INTERVAL_MS 2
+
+// Καθε ποσους γυρους αποσυρονται οι νεκροι συμμετεχοντες (~1s στο idle)
+#define REAP_EVERY_N_POLLS 500
+
+// Οριο του buffer εξοδου - πανω απο αυτο δεν διαβαζεται η ουρα
+#define OUT_HIGH_WATERMARK (256 * 1024)
+#define IO_BUFFER_SIZE (OUT_HIGH_WATERMARK + RECEIVE_BATCH * (MSG_TEXT_SIZE + 8))
+
+/*
+ * Κεφαλιδα frame στο καλωδιο (network byte order), ακολουθει το κειμενο
+ */
+typedef struct {
+    unsigned int dialog_id;
+    unsigned short length;
+    unsigned short reserved;
+} FrameHeader;
+
+// Αντιστοιχιση τοπικου διαλογου με τον διαλογο του peer
+typedef struct {
+    int local_id;
+    int remote_id;
+    int active;
+} BridgedDialog;
+
+static BridgedDialog bridged[MAX_DIALOGS];
+static int bridged_count = 0;
+
+static char out_buffer[IO_BUFFER_SIZE];
+static size_t out_len = 0;
+static char in_buffer[IO_BUFFER_SIZE];
+static size_t in_len = 0;
+
+static volatile sig_atomic_t keep_running = 1;
+
+static void handle_signal(int sig) {
+    (void) sig;
+    keep_running = 0;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*
+ * Αναμονη για ενα peer στη θυρα port
+ */
+static int listen_for_peer(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short) port);
+
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) {
+        perror("Αποτυχια bind/listen");
+        close(listen_fd);
+        return -1;
+    }
+
+    printf("Αναμονη για peer στη θυρα %d...\n", port);
+    fflush(stdout);
+
+    int fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (fd < 0) {
+        perror("Αποτυχια accept");
+    }
+    return fd;
+}
+
+/*
+ * Συνδεση στο peer (host:port)
+ */
+static int connect_to_peer(const char* target) {
+    char host[256];
+    const char* colon = strrchr(target, ':');
+    if (colon == NULL || (size_t) (colon - target) >= sizeof(host)) {
+        fprintf(stderr, "Μη εγκυρη διευθυνση: %s\n", target);
+        return -1;
+    }
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+
+    struct addrinfo hints;
+    struct addrinfo* result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        fprintf(stderr, "Αποτυχια getaddrinfo για %s\n", target);
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        perror("Αποτυχια συνδεσης στο peer");
+    }
+    return fd;
+}
+
+/*
+ * Μεταφορα μηνυματων απο τους τοπικους διαλογους στον buffer εξοδου
+ * Τα μηνυματα που εβαλε η ιδια η γεφυρα δεν ξαναστελνονται (αποφυγη loop).
+ */
+static int drain_local_dialogs(SharedMemoryData* memory) {
+    ReceivedMessage batch[RECEIVE_BATCH];
+    pid_t my_pid = getpid();
+    int moved = 0;
+
+    for (int i = 0; i < bridged_count; i++) {
+        if (!bridged[i].active) continue;
+
+        int count;
+        do {
+            if (out_len >= OUT_HIGH_WATERMARK) {
+                return moved;  // backpressure: η ουρα περιμενει
+            }
+
+            count = receive_msgs(memory, bridged[i].local_id, batch, RECEIVE_BATCH);
+            if (count < 0) {
+                bridged[i].active = 0;  // ο διαλογος εκλεισε (εφυγαν τα μελη του)
+                break;
+            }
+            for (int m = 0; m < count; m++) {
+                // Μετα το TERMINATE η γεφυρα δεν ειναι πια ενεργη στον διαλογο,
+                // ακομα κι αν το εφερε η ιδια απο το peer
+                int terminate = strcmp(batch[m].text, "TERMINATE") == 0;
+                if (terminate) {
+                    bridged[i].active = 0;
+                }
+                if (batch[m].sender_pid == my_pid) continue;
+
+                FrameHeader header;
+                size_t length = strnlen(batch[m].text, MSG_TEXT_SIZE - 1);
+                header.dialog_id = htonl((unsigned int) bridged[i].local_id);
+                header.length = htons((unsigned short) length);
+                header.reserved = 0;
+
+                memcpy(out_buffer + out_len, &header, sizeof(header));
+                memcpy(out_buffer + out_len + sizeof(header), batch[m].text, length);
+                out_len += sizeof(header) + length;
+                moved++;
+            }
+        } while (count == RECEIVE_BATCH && bridged[i].active);
+    }
+
+    return moved;
+}
+
+/*
+ * Στελνει οσα χωρανε απο τον buffer εξοδου - 0 αν ολα καλα, -1 αν επεσε η συνδεση
+ */
+static int flush_output(int fd) {
+    size_t sent = 0;
+
+    while (sent < out_len) {
+        ssize_t n = send(fd, out_buffer + sent, out_len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        sent += (size_t) n;
+    }
+
+    memmove(out_buffer, out_buffer + sent, out_len - sent);
+    out_len -= sent;
+    return 0;
+}
+
+/*
+ * Βρισκει τον τοπικο διαλογο που αντιστοιχει στο ID του peer
+ */
+static int local_dialog_for(unsigned int remote_id) {
+    for (int i = 0; i < bridged_count; i++) {
+        if ((unsigned int) bridged[i].remote_id == remote_id) {
+            return bridged[i].local_id;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Βαζει στους τοπικους διαλογους τα πληρη frames του buffer εισοδου
+ * Διαδοχικα frames του ιδιου διαλογου μπαινουν με ενα send_msgs.
+ * Επιστρεφει 1 αν η τοπικη ουρα γεμισε και εμειναν frames, -1 αν ηρθε
+ * frame μεγαλυτερο απο οσο χωραει ενα μηνυμα (λαθος πρωτοκολλου).
+ */
+static int inject_frames(SharedMemoryData* memory) {
+    const char* texts[RECEIVE_BATCH];
+    char copies[RECEIVE_BATCH][MSG_TEXT_SIZE];
+    size_t frame_end[RECEIVE_BATCH];
+    size_t offset = 0;
+    int queue_full = 0;
+
+    while (!queue_full) {
+        int batch_dialog = -1;
+        int count = 0;
+        size_t position = offset;
+
+        // Μαζευω διαδοχικα πληρη frames για τον ιδιο διαλογο
+        while (count < RECEIVE_BATCH && position + sizeof(FrameHeader) <= in_len) {
+            FrameHeader header;
+            memcpy(&header, in_buffer + position, sizeof(header));
+            size_t length = ntohs(header.length);
+            if (length >= MSG_TEXT_SIZE) return -1;
+            if (position + sizeof(header) + length > in_len) break;
+
+            int dialog_id = local_dialog_for(ntohl(header.dialog_id));
+
+            // Frame για διαλογο που δεν γεφυρωνεται - απορριπτεται, αλλα μονο
+            // πριν το batch: μετα θα προσπερνουσε frames που δεν μπηκαν ακομα
+            if (dialog_id < 0) {
+                if (count > 0) break;
+                position += sizeof(header) + length;
+                offset = position;
+                continue;
+            }
+            if (count > 0 && dialog_id != batch_dialog) break;
+
+            position += sizeof(header) + length;
+
+            batch_dialog = dialog_id;
+            memcpy(copies[count], in_buffer + position - length, length);
+            copies[count][length] = '\0';
+            texts[count] = copies[count];
+            frame_end[count] = position;
+            count++;
+        }
+
+        if (count == 0) break;
+
+        int injected = send_msgs(memory, batch_dialog, texts, count);
+        if (injected < 0) {
+            injected = count;  // ο διαλογος εκλεισε, τα πεταω
+        }
+
+        // Προχωραω μονο οσα frames μπηκαν πραγματικα
+        if (injected > 0) {
+            offset = frame_end[injected - 1];
+        }
+        queue_full = injected < count;
+    }
+
+    memmove(in_buffer, in_buffer + offset, in_len - offset);
+    in_len -= offset;
+    return queue_full;
+}
+
+/*
+ * Διαβαζει οτι υπαρχει στο socket - 0 αν ολα καλα, -1 αν εκλεισε η συνδεση
+ */
+static int read_input(int fd) {
+    while (in_len < sizeof(in_buffer)) {
+        ssize_t n = recv(fd, in_buffer + in_len, sizeof(in_buffer) - in_len, 0);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        in_len += (size_t) n;
+    }
+    return 0;
+}
+
+static void update_interest(int epoll_fd, int fd, int want_read, int want_write) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    // Το EPOLLRDHUP μονο οσο διαβαζω, αλλιως με level triggering μετα το
+    // half-close του peer το epoll_wait θα γυρναγε αμεσως συνεχεια
+    ev.events = want_read ? (EPOLLIN | EPOLLRDHUP) : 0;
+    ev.events |= want_write ? EPOLLOUT : 0;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Χρηση: %s (-l port | -c host:port) -d local_id:remote_id ...\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int listen_port = -1;
+    const char* peer = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:c:d:h")) != -1) {
+        switch (opt) {
+            case 'l': listen_port = atoi(optarg); break;
+            case 'c': peer = optarg; break;
+            case 'd':
+                if (bridged_count == MAX_DIALOGS ||
+                    sscanf(optarg, "%d:%d", &bridged[bridged_count].local_id,
+                           &bridged[bridged_count].remote_id) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                bridged_count++;
+                break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if ((listen_port < 0) == (peer == NULL) || bridged_count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    SharedMemoryData* memory = connect_to_shared_memory(NULL, 0);
+    if (memory == NULL) {
+        fprintf(stderr, "Σφαλμα: Δεν υπαρχει ενεργο συστημα.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < bridged_count; i++) {
+        if (observe_dialog(memory, bridged[i].local_id) < 0) {
+            fprintf(stderr, "Αδυναμια συμμετοχης στον διαλογο %d\n", bridged[i].local_id);
+            disconnect_from_shared_memory(memory);
+            return 1;
+        }
+        bridged[i].active = 1;
+    }
+
+    int fd = (peer != NULL) ? connect_to_peer(peer) : listen_for_peer(listen_port);
+    if (fd < 0) {
+        for (int i = 0; i < bridged_count; i++) {
+            leave_dialog(memory, bridged[i].local_id);
+        }
+        disconnect_from_shared_memory(memory);
+        return 1;
+    }
+
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    set_nonblocking(fd);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+    printf("Γεφυρα ενεργη (%d διαλογοι)\n", bridged_count);
+    fflush(stdout);
+
+    int local_full = 0;
+    int peer_closed = 0;
+    int polls = 0;
+
+    while (keep_running && !peer_closed) {
+        struct epoll_event events[4];
+
+        // Ενας διαλογος που εμεινε μονο με παρατηρητες κλεινει μονο αν τρεξει ο reaper
+        if (++polls % REAP_EVERY_N_POLLS == 0) {
+            lock_memory(memory);
+            reap_dead_participants(memory);
+            unlock_memory(memory);
+        }
+
+        // Η shared memory δεν εχει ειδοποιησεις, οποτε το epoll εχει timeout
+        int ready = epoll_wait(epoll_fd, events, 4, POLL_INTERVAL_MS);
+        if (ready < 0 && errno != EINTR) break;
+
+        for (int e = 0; e < ready; e++) {
+            if (events[e].events & EPOLLIN) {
+                if (read_input(fd) < 0) peer_closed = 1;
+            }
+            if (events[e].events & (EPOLLHUP | EPOLLERR)) {
+                peer_closed = 1;
+            }
+        }
+
+        // Απο το peer προς την τοπικη ουρα
+        if (in_len > 0) {
+            local_full = inject_frames(memory);
+            if (local_full < 0) {
+                fprintf(stderr, "Μη εγκυρο frame απο το peer, κλεισιμο συνδεσης\n");
+                peer_closed = 1;
+                break;
+            }
+        }
+
+        // Απο την τοπικη ουρα προς το peer
+        drain_local_dialogs(memory);
+        if (out_len > 0 && flush_output(fd) < 0) {
+            peer_closed = 1;
+        }
+
+        // Διαβαζω το socket μονο αν χωραει και η τοπικη ουρα δεν ειναι γεματη
+        int want_read = !local_full && in_len < sizeof(in_buffer);
+        update_interest(epoll_fd, fd, want_read, out_len > 0);
+    }
+
+    if (peer_closed) {
+        printf("Το peer αποσυνδεθηκε.\n");
+    }
+
+    close(epoll_fd);
+    close(fd);
+
+    for (int i = 0; i < bridged_count; i++) {
+        if (bridged[i].active) {
+            leave_dialog(memory, bridged[i].local_id);
+        }
+    }
+    disconnect_from_shared_memory(memory);
+
+    return 0;
+}
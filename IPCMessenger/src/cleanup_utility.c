@@ -2,14 +2,27 @@
  * cleanup_utility.c - Εργαλειο για χειροκινητο καθαρισμο της shared memory
  * 
  * Χρησιμο οταν το προγραμμα κλεινει αποτομα και η shared memory μενει στο συστημα
+ * 
+ * Χρηση: cleanup [shards]  - με αριθμο shards καθαριζονται ολα τα shards
+ *                            του προεπιλεγμενου namespace
  */
 
 #include "shm_manager.h"
 #include <stdio.h>
+#include <stdlib.h>
 
-int main() {
+int main(int argc, char* argv[]) {
+    ShmNamespace base;
+    int shards = (argc > 1) ? atoi(argv[1]) : 1;
+    
+    default_namespace(&base);
+    
     printf("Καθαρισμος shared memory...\n");
-    cleanup_shared_memory();
+    for (int i = 0; i < shards; i++) {
+        ShmNamespace ns;
+        shard_namespace(&ns, &base, i);
+        cleanup_shared_memory(&ns);
+    }
     printf("Ολοκληρωθηκε.\n");
     return 0;
 }
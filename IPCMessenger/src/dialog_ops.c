@@ -4,21 +4,88 @@
  * Εδω υλοποιω τη δημιουργια και συμμετοχη σε διαλογους
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "dialog_ops.h"
 #include "shm_manager.h"
+#include "metrics.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
+#include <errno.h>
+
+// Cache ανα διεργασια: η θεση μου σε καθε slot διαλογου (γεμιζει στο join)
+static int cached_dialog_id[MAX_DIALOGS];
+static int cached_index[MAX_DIALOGS];
+
+/*
+ * Η αρχικη θεση ενος ID στον πινακα κατακερματισμου
+ * Τα IDs ειναι διαδοχικα, οποτε το mask τα σκορπιζει ομοιομορφα
+ */
+static int dialog_hash_home(int dialog_id) {
+    return (int) ((unsigned int) dialog_id & (DIALOG_HASH_SIZE - 1));
+}
+
+/*
+ * Καταχωρηση ενος διαλογου στον πινακα κατακερματισμου
+ */
+static void dialog_hash_insert(SharedMemoryData* memory, int dialog_id, int slot) {
+    int pos = dialog_hash_home(dialog_id);
+    
+    while (memory->dialog_hash[pos] != DIALOG_HASH_EMPTY) {
+        pos = (pos + 1) & (DIALOG_HASH_SIZE - 1);
+    }
+    memory->dialog_hash[pos] = slot;
+}
 
 /*
- * Βρισκει ενα διαλογο με βαση το ID του
+ * Αφαιρεση απο τον πινακα με backward shift, ωστε να μη μενουν tombstones
+ */
+static void dialog_hash_remove(SharedMemoryData* memory, int dialog_id) {
+    int pos = dialog_hash_home(dialog_id);
+    
+    while (memory->dialog_hash[pos] != DIALOG_HASH_EMPTY) {
+        if (memory->all_dialogs[memory->dialog_hash[pos]].dialog_id == dialog_id) {
+            break;
+        }
+        pos = (pos + 1) & (DIALOG_HASH_SIZE - 1);
+    }
+    if (memory->dialog_hash[pos] == DIALOG_HASH_EMPTY) {
+        return;
+    }
+    
+    // Μετακινω πισω οσες εγγραφες της ιδιας αλυσιδας ακολουθουν
+    int hole = pos;
+    int next = pos;
+    for (;;) {
+        next = (next + 1) & (DIALOG_HASH_SIZE - 1);
+        if (memory->dialog_hash[next] == DIALOG_HASH_EMPTY) break;
+        
+        int home = dialog_hash_home(memory->all_dialogs[memory->dialog_hash[next]].dialog_id);
+        int distance_to_hole = (hole - home) & (DIALOG_HASH_SIZE - 1);
+        int distance_to_next = (next - home) & (DIALOG_HASH_SIZE - 1);
+        
+        if (distance_to_hole < distance_to_next) {
+            memory->dialog_hash[hole] = memory->dialog_hash[next];
+            hole = next;
+        }
+    }
+    memory->dialog_hash[hole] = DIALOG_HASH_EMPTY;
+}
+
+/*
+ * Βρισκει ενα διαλογο με βαση το ID του (μεσω του πινακα κατακερματισμου)
  */
 DialogInfo* get_dialog_by_id(SharedMemoryData* memory, int dialog_id) {
-    for (int i = 0; i < MAX_DIALOGS; i++) {
-        if (memory->all_dialogs[i].active && 
-            memory->all_dialogs[i].dialog_id == dialog_id) {
-            return &memory->all_dialogs[i];
+    int pos = dialog_hash_home(dialog_id);
+    
+    while (memory->dialog_hash[pos] != DIALOG_HASH_EMPTY) {
+        DialogInfo* dialog = &memory->all_dialogs[memory->dialog_hash[pos]];
+        if (dialog->active && dialog->dialog_id == dialog_id) {
+            return dialog;
         }
+        pos = (pos + 1) & (DIALOG_HASH_SIZE - 1);
     }
     return NULL;
 }
@@ -35,12 +102,176 @@ int find_participant_index(DialogInfo* dialog, pid_t pid) {
     return -1;
 }
 
+/*
+ * Ελεγχει αν μια διεργασια ζει ακομα (το σημα 0 δεν στελνεται, μονο ελεγχος)
+ * EPERM σημαινει οτι υπαρχει αλλα ανηκει σε αλλον χρηστη
+ */
+int process_is_alive(pid_t pid) {
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/*
+ * Ελεγχει αν μενει ενεργο κανονικο μελος - οι παρατηρητες δεν μετρανε
+ */
+int dialog_has_members(const DialogInfo* dialog) {
+    for (int p = 0; p < dialog->participant_count; p++) {
+        if (dialog->participants[p].is_active && !dialog->participants[p].is_observer) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Ελεγχει αν ολοι οι ενεργοι συμμετεχοντες εχουν διαβασει το μηνυμα
+ */
+int all_active_have_read(const DialogInfo* dialog, const MessageEntry* msg) {
+    for (int p = 0; p < dialog->participant_count; p++) {
+        // Αν ειναι ενεργος και δεν το διαβασε
+        if (dialog->participants[p].is_active && !msg->has_been_read[p]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Αποσυρει τους συμμετεχοντες που πεθαναν χωρις να στειλουν TERMINATE
+ * και απελευθερωνει οτι κρατουσαν:
+ *   - διαλογους χωρις ενεργο μελος (οι παρατηρητες δεν τους κρατανε)
+ *   - μηνυματα που πλεον τα εχουν διαβασει ολοι οι ζωντανοι
+ *   - μηνυματα διαλογων που δεν υπαρχουν πια
+ * Καλειται με το lock κρατημενο. Επιστρεφει ποσους συμμετεχοντες αποσυρε.
+ */
+int reap_dead_participants(SharedMemoryData* memory) {
+    int reaped = 0;
+    
+    for (int d = 0; d < MAX_DIALOGS; d++) {
+        DialogInfo* dialog = &memory->all_dialogs[d];
+        if (!dialog->active) continue;
+        
+        for (int p = 0; p < dialog->participant_count; p++) {
+            Participant* participant = &dialog->participants[p];
+            if (!participant->is_active) continue;
+            
+            if (!process_is_alive(participant->process_id)) {
+                participant->is_active = 0;
+                reaped++;
+            }
+        }
+        
+        if (!dialog_has_members(dialog)) {
+            release_dialog(memory, dialog);
+        }
+    }
+    
+    // Ανακτηση θεσεων της ουρας
+    for (int i = 0; i < MAX_MSGS_IN_QUEUE; i++) {
+        MessageEntry* msg = &memory->message_queue[i];
+        if (msg->occupied == 0) continue;
+        
+        DialogInfo* dialog = get_dialog_by_id(memory, msg->belongs_to_dialog);
+        if (dialog == NULL || all_active_have_read(dialog, msg)) {
+            msg->occupied = 0;
+            metrics_queue_pop(memory);
+        }
+    }
+    
+    return reaped;
+}
+
+/*
+ * Βρισκει μια θεση για νεο συμμετεχοντα - πρωτα ξαναχρησιμοποιει θεσεις
+ * ανενεργων, αλλιως επεκτεινει τον πινακα. Επιστρεφει -1 αν ειναι γεματος.
+ */
+static int claim_participant_slot(SharedMemoryData* memory, DialogInfo* dialog) {
+    int p = 0;
+    while (p < dialog->participant_count && dialog->participants[p].is_active) {
+        p++;
+    }
+    if (p == MAX_PARTICIPANTS) {
+        return -1;
+    }
+    if (p == dialog->participant_count) {
+        dialog->participant_count++;
+    }
+    
+    // Ο νεος δεν βλεπει οσα ηταν ηδη στην ουρα - ουτε σε νεα θεση, οπου
+    // το has_been_read εχει οτι αφησε ενας παλιος διαλογος
+    for (int i = 0; i < MAX_MSGS_IN_QUEUE; i++) {
+        MessageEntry* msg = &memory->message_queue[i];
+        if (msg->occupied && msg->belongs_to_dialog == dialog->dialog_id) {
+            msg->has_been_read[p] = 1;
+        }
+    }
+    return p;
+}
+
+/*
+ * Αποθηκευει στην cache τη θεση μου σε ενα διαλογο
+ */
+static void remember_participant_index(SharedMemoryData* memory, DialogInfo* dialog, int index) {
+    int slot = (int) (dialog - memory->all_dialogs);
+    cached_dialog_id[slot] = dialog->dialog_id;
+    cached_index[slot] = index;
+}
+
+/*
+ * Επιστρεφει τη θεση μου στον διαλογο χωρις αναζητηση
+ * Η cache ελεγχεται με το PID στη shared memory, ετσι μια θεση που
+ * κληρονομηθηκε με fork η ανηκει σε παλιο διαλογο δεν γινεται δεκτη.
+ * Αν δεν ταιριαζει, πεφτω πισω στο find_participant_index.
+ */
+int my_participant_index(SharedMemoryData* memory, DialogInfo* dialog, pid_t pid) {
+    int slot = (int) (dialog - memory->all_dialogs);
+    int index = cached_index[slot];
+    
+    if (cached_dialog_id[slot] == dialog->dialog_id &&
+        index < dialog->participant_count &&
+        dialog->participants[index].process_id == pid) {
+        return index;
+    }
+    
+    index = find_participant_index(dialog, pid);
+    if (index >= 0) {
+        remember_participant_index(memory, dialog, index);
+    }
+    return index;
+}
+
+/*
+ * Κλεινει εναν διαλογο και τον βγαζει απο τον πινακα κατακερματισμου
+ * (καλειται με το lock κρατημενο)
+ */
+void release_dialog(SharedMemoryData* memory, DialogInfo* dialog) {
+    dialog_hash_remove(memory, dialog->dialog_id);
+    dialog->active = 0;
+}
+
+/*
+ * Αποχωρηση απο διαλογο χωρις TERMINATE - η θεση μου παυει να
+ * κραταει μηνυματα στην ουρα
+ */
+void leave_dialog(SharedMemoryData* memory, int dialog_id) {
+    lock_memory(memory);
+    
+    DialogInfo* dialog = get_dialog_by_id(memory, dialog_id);
+    if (dialog != NULL) {
+        int index = my_participant_index(memory, dialog, getpid());
+        if (index >= 0) {
+            dialog->participants[index].is_active = 0;
+        }
+    }
+    
+    unlock_memory(memory);
+}
+
 /*
  * Δημιουργει εναν νεο διαλογο
  * Επιστρεφει το ID του διαλογου η -1 σε αποτυχια
  */
 int start_new_dialog(SharedMemoryData* memory) {
-    lock_memory();
+    lock_memory(memory);
     
     // Ψαχνω για κενη θεση στον πινακα διαλογων
     int free_slot = -1;
@@ -52,7 +283,7 @@ int start_new_dialog(SharedMemoryData* memory) {
     }
     
     if (free_slot == -1) {
-        unlock_memory();
+        unlock_memory(memory);
         fprintf(stderr, "Δεν υπαρχουν διαθεσιμες θεσεις για νεο διαλογο!\n");
         return -1;
     }
@@ -65,46 +296,82 @@ int start_new_dialog(SharedMemoryData* memory) {
     
     // Προσθηκη του τρεχοντος process ως πρωτου συμμετεχοντα
     new_dialog->participant_count = 1;
+    new_dialog->next_seq = 1;
     new_dialog->participants[0].process_id = getpid();
     new_dialog->participants[0].is_active = 1;
+    new_dialog->participants[0].is_observer = 0;
+    
+    dialog_hash_insert(memory, new_dialog->dialog_id, free_slot);
+    remember_participant_index(memory, new_dialog, 0);
+    metrics_reset_dialog(memory, free_slot, new_dialog->dialog_id);
     
     int created_id = new_dialog->dialog_id;
     
-    unlock_memory();
+    unlock_memory(memory);
     
     return created_id;
 }
 
 /*
- * Συμμετοχη σε υπαρχοντα διαλογο
- * Επιστρεφει 0 σε επιτυχια, -1 σε αποτυχια
+ * Συμμετοχη σε υπαρχοντα διαλογο, σαν μελος η σαν παρατηρητης
+ * Επιστρεφει τη θεση του συμμετεχοντα σε επιτυχια, -1 σε αποτυχια
  */
-int participate_in_dialog(SharedMemoryData* memory, int dialog_id) {
-    lock_memory();
+static int join_dialog(SharedMemoryData* memory, int dialog_id, int is_observer, unsigned long* join_seq) {
+    lock_memory(memory);
     
     // Βρισκω τον διαλογο
     DialogInfo* target_dialog = get_dialog_by_id(memory, dialog_id);
     
     if (target_dialog == NULL) {
-        unlock_memory();
+        unlock_memory(memory);
         fprintf(stderr, "Δεν βρεθηκε διαλογος με ID %d!\n", dialog_id);
         return -1;
     }
     
     // Ελεγχος αν υπαρχει χωρος για αλλον συμμετεχοντα
-    if (target_dialog->participant_count >= MAX_PARTICIPANTS) {
-        unlock_memory();
+    int new_index = claim_participant_slot(memory, target_dialog);
+    if (new_index == -1) {
+        // Ισως καποιος εχει πεθανει και κραταει θεση
+        reap_dead_participants(memory);
+        target_dialog = get_dialog_by_id(memory, dialog_id);
+        if (target_dialog != NULL) {
+            new_index = claim_participant_slot(memory, target_dialog);
+        }
+    }
+    
+    if (new_index == -1) {
+        unlock_memory(memory);
         fprintf(stderr, "Ο διαλογος ειναι γεματος!\n");
         return -1;
     }
     
     // Προσθηκη του τρεχοντος process
-    int new_index = target_dialog->participant_count;
     target_dialog->participants[new_index].process_id = getpid();
     target_dialog->participants[new_index].is_active = 1;
-    target_dialog->participant_count++;
+    target_dialog->participants[new_index].is_observer = is_observer;
+    if (join_seq != NULL) {
+        *join_seq = target_dialog->next_seq;
+    }
     
-    unlock_memory();
+    remember_participant_index(memory, target_dialog, new_index);
     
-    return 0;
+    unlock_memory(memory);
+    
+    return new_index;
+}
+
+/*
+ * Συμμετοχη σε υπαρχοντα διαλογο
+ * Επιστρεφει τη θεση του συμμετεχοντα σε επιτυχια, -1 σε αποτυχια
+ */
+int participate_in_dialog(SharedMemoryData* memory, int dialog_id, unsigned long* join_seq) {
+    return join_dialog(memory, dialog_id, 0, join_seq);
+}
+
+/*
+ * Συμμετοχη σαν παρατηρητης - διαβαζει οπως ενα μελος, αλλα οταν δεν μενει
+ * κανενα ενεργο μελος ο διαλογος κλεινει και ο παρατηρητης παιρνει -1 απο το receive_msgs
+ */
+int observe_dialog(SharedMemoryData* memory, int dialog_id) {
+    return join_dialog(memory, dialog_id, 1, NULL);
 }
@@ -0,0 +1,137 @@
+/*
+ * dialog_stat.c - Εμφανιση των μετρησεων ενος ενεργου συστηματος
+ * 
+ * Χρηση: dialog_stat [-i seconds] [-n count]
+ * 
+ * Διαβαζει το Metrics της shared memory χωρις να παιρνει το lock,
+ * ωστε να μπορει να τρεχει διπλα σε φορτωμενο συστημα χωρις να το
+ * επηρεαζει. Με -i τυπωνει snapshot καθε τοσα δευτερολεπτα, μαζι
+ * με τον ρυθμο αποστολης απο το προηγουμενο.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "types.h"
+#include "shm_manager.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Χρονος σε αναγνωσιμη μορφη
+ */
+static void format_ns(char* out, size_t size, unsigned long long ns) {
+    if (ns == 0) {
+        snprintf(out, size, "-");
+    } else if (ns < 1000ULL) {
+        snprintf(out, size, "%lluns", ns);
+    } else if (ns < 1000000ULL) {
+        snprintf(out, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000ULL) {
+        snprintf(out, size, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(out, size, "%.2fs", ns / 1e9);
+    }
+}
+
+/*
+ * Snapshot χωρις lock - οι μετρητες μπορει να ειναι στη μεση ενημερωσης,
+ * που για στατιστικα δεν πειραζει
+ */
+static void take_snapshot(const SharedMemoryData* memory, Metrics* metrics, DialogInfo* dialogs) {
+    const volatile SharedMemoryData* shared = memory;
+    memcpy(metrics, (const void*) &shared->metrics, sizeof(*metrics));
+    memcpy(dialogs, (const void*) shared->all_dialogs, sizeof(shared->all_dialogs));
+}
+
+static void print_snapshot(const Metrics* metrics, const DialogInfo* dialogs,
+                           const Metrics* previous, double interval) {
+    char avg[16], max[16];
+    unsigned long long avg_ns = metrics->lock_wait_samples
+        ? metrics->lock_wait_ns / metrics->lock_wait_samples : 0;
+    format_ns(avg, sizeof(avg), avg_ns);
+    format_ns(max, sizeof(max), metrics->lock_wait_max_ns);
+    
+    printf("Lock: %lu κλειδωματα, αναμονη avg %s max %s (%lu δειγματα)\n",
+           metrics->lock_acquisitions, avg, max, metrics->lock_wait_samples);
+    printf("Ουρα: %d/%d θεσεις (μεγιστο %d)\n",
+           metrics->queue_depth, MAX_MSGS_IN_QUEUE, metrics->queue_high_water);
+    printf("%6s %6s %10s %10s %8s %10s %8s %8s %8s\n",
+           "ID", "Συμμ.", "Σταλθηκαν", "Παραδοσεις", "Γεματη", "msg/s", "p50", "p99", "max");
+    
+    for (int d = 0; d < MAX_DIALOGS; d++) {
+        const DialogInfo* dialog = &dialogs[d];
+        const DialogMetrics* dm = &metrics->dialogs[d];
+        if (!dialog->active || dm->dialog_id != dialog->dialog_id) continue;
+        
+        int participants = 0;
+        for (int p = 0; p < dialog->participant_count && p < MAX_PARTICIPANTS; p++) {
+            participants += dialog->participants[p].is_active ? 1 : 0;
+        }
+        
+        // Ρυθμος μονο αν το ιδιο slot ειχε τον ιδιο διαλογο στο προηγουμενο snapshot
+        char rate[16] = "-";
+        const DialogMetrics* before = previous ? &previous->dialogs[d] : NULL;
+        if (before != NULL && before->dialog_id == dm->dialog_id && interval > 0) {
+            snprintf(rate, sizeof(rate), "%.0f", (dm->sent - before->sent) / interval);
+        }
+        
+        char p50[16], p99[16], top[16];
+        format_ns(p50, sizeof(p50), metrics_latency_percentile(dm, 0.50));
+        format_ns(p99, sizeof(p99), metrics_latency_percentile(dm, 0.99));
+        format_ns(top, sizeof(top), metrics_latency_percentile(dm, 1.0));
+        
+        printf("%6d %6d %10lu %10lu %8lu %10s %8s %8s %8s\n",
+               dialog->dialog_id, participants, dm->sent, dm->delivered,
+               dm->queue_full, rate, p50, p99, top);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    double interval = 0;
+    int count = -1;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+        switch (opt) {
+            case 'i': interval = atof(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Χρηση: %s [-i seconds] [-n count]\n", argv[0]);
+                return 1;
+        }
+    }
+    
+    // Χωρις -i ενα μονο snapshot
+    if (interval <= 0) {
+        count = 1;
+    }
+    
+    SharedMemoryData* memory = connect_to_shared_memory(NULL, 0);
+    if (memory == NULL) {
+        fprintf(stderr, "Σφαλμα: Δεν υπαρχει ενεργο συστημα.\n");
+        return 1;
+    }
+    
+    static Metrics snapshots[2];
+    static DialogInfo dialogs[MAX_DIALOGS];
+    int current = 0;
+    
+    for (int round = 0; count < 0 || round < count; round++) {
+        if (round > 0) {
+            usleep((useconds_t) (interval * 1e6));
+            printf("\n");
+        }
+        
+        take_snapshot(memory, &snapshots[current], dialogs);
+        print_snapshot(&snapshots[current], dialogs,
+                       round > 0 ? &snapshots[1 - current] : NULL, interval);
+        current = 1 - current;
+    }
+    
+    disconnect_from_shared_memory(memory);
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * journal.c - Υλοποιηση του append-only journal ανα διαλογο
+ *
+ * Μορφη αρχειου: JournalFileHeader και μετα διαδοχικες εγγραφες
+ * JournalRecordHeader + κειμενο.
+ * Μια μισογραμμενη εγγραφη στο τελος (π.χ. μετα απο crash) απλα
+ * αγνοειται στο replay.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Αρχικο μεγεθος των buffers - διπλασιαζεται αν χρειαστει
+#define JOURNAL_INITIAL_BUFFER (64 * 1024)
+
+/*
+ * Εξασφαλιζει οτι ο buffer χωραει needed bytes
+ */
+static int ensure_capacity(char** buffer, size_t* capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity ? *capacity : JOURNAL_INITIAL_BUFFER;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    char* grown = realloc(*buffer, new_capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+
+    *buffer = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Ανοιγει το αρχειο του διαλογου για append
+ * Ενα αρχειο αλλης εκτελεσης (αλλο instance_tag) ξεκιναει απο την αρχη.
+ */
+int journal_open(JournalWriter* writer, const char* dir, int dialog_id,
+                 unsigned long long instance_tag) {
+    char path[512];
+    snprintf(path, sizeof(path), JOURNAL_FILE_FORMAT, dir, dialog_id);
+
+    memset(writer, 0, sizeof(*writer));
+    writer->dialog_id = dialog_id;
+    writer->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (writer->fd < 0) {
+        perror("Αποτυχια ανοιγματος journal");
+        return -1;
+    }
+
+    JournalFileHeader header;
+    ssize_t got = pread(writer->fd, &header, sizeof(header), 0);
+    if (got != (ssize_t) sizeof(header) || header.magic != JOURNAL_MAGIC ||
+        header.instance_tag != instance_tag) {
+        memset(&header, 0, sizeof(header));
+        header.magic = JOURNAL_MAGIC;
+        header.instance_tag = instance_tag;
+
+        if (ftruncate(writer->fd, 0) < 0 ||
+            write(writer->fd, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+            perror("Αποτυχια αρχικοποιησης journal");
+            close(writer->fd);
+            writer->fd = -1;
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    return 0;
+}
+
+/*
+ * Προσθετει ενα μηνυμα στο pending buffer - καθολου I/O εδω
+ */
+int journal_append(JournalWriter* writer, const ReceivedMessage* msg) {
+    JournalRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.seq = msg->seq;
+    header.sender_pid = (int) msg->sender_pid;
+    header.length = (unsigned int) strnlen(msg->text, MSG_TEXT_SIZE);
+
+    pthread_mutex_lock(&writer->lock);
+
+    size_t needed = writer->pending_len + sizeof(header) + header.length;
+    if (ensure_capacity(&writer->pending, &writer->pending_cap, needed) < 0) {
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+
+    memcpy(writer->pending + writer->pending_len, &header, sizeof(header));
+    memcpy(writer->pending + writer->pending_len + sizeof(header), msg->text, header.length);
+    writer->pending_len = needed;
+
+    pthread_mutex_unlock(&writer->lock);
+    return 0;
+}
+
+/*
+ * Group commit: παιρνει ολα οσα μαζευτηκαν, τα γραφει με ενα write
+ * και κανει ενα fdatasync για ολη την ομαδα
+ */
+int journal_commit(JournalWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+
+    size_t length = writer->pending_len;
+    if (length == 0) {
+        pthread_mutex_unlock(&writer->lock);
+        return 0;
+    }
+
+    // Ανταλλαγη buffers - ο receiver συνεχιζει στον αλλον
+    char* batch = writer->pending;
+    size_t batch_cap = writer->pending_cap;
+    writer->pending = writer->writing;
+    writer->pending_cap = writer->writing_cap;
+    writer->pending_len = 0;
+    writer->writing = batch;
+    writer->writing_cap = batch_cap;
+
+    pthread_mutex_unlock(&writer->lock);
+
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(writer->fd, batch + written, length - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Αποτυχια εγγραφης journal");
+            return -1;
+        }
+        written += (size_t) n;
+    }
+
+    if (fdatasync(writer->fd) < 0) {
+        perror("Αποτυχια fdatasync journal");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Τελικο commit και απελευθερωση ολων των πορων
+ */
+void journal_close(JournalWriter* writer) {
+    if (writer->fd < 0) {
+        return;
+    }
+
+    journal_commit(writer);
+    close(writer->fd);
+    writer->fd = -1;
+
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->pending);
+    free(writer->writing);
+    writer->pending = NULL;
+    writer->writing = NULL;
+}
+
+/*
+ * Διαβαζει το journal ενος διαλογου και καλει το callback για καθε
+ * μηνυμα με from_seq <= seq < until_seq (until_seq == 0: χωρις ανω οριο)
+ */
+long journal_replay(const char* dir, int dialog_id, unsigned long from_seq, unsigned long until_seq,
+                    unsigned long long instance_tag, JournalReplayFn callback, void* ctx) {
+    char path[512];
+    snprintf(path, sizeof(path), JOURNAL_FILE_FORMAT, dir, dialog_id);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    // Μεγαλο buffer στο stdio για να διαβαζεται σε λιγα read()
+    setvbuf(file, NULL, _IOFBF, JOURNAL_INITIAL_BUFFER);
+
+    // Αρχειο παλιας μορφης η αλλης εκτελεσης δεν ειναι αυτος ο διαλογος
+    JournalFileHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, file) != 1 ||
+        file_header.magic != JOURNAL_MAGIC ||
+        (instance_tag != 0 && file_header.instance_tag != instance_tag)) {
+        fclose(file);
+        return -1;
+    }
+
+    long replayed = 0;
+    JournalRecordHeader header;
+    ReceivedMessage msg;
+
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        if (header.length >= MSG_TEXT_SIZE) {
+            break;  // χαλασμενη εγγραφη
+        }
+        if (fread(msg.text, 1, header.length, file) != header.length) {
+            break;  // μισογραμμενη εγγραφη στο τελος
+        }
+
+        if (header.seq < from_seq) {
+            continue;
+        }
+        if (until_seq != 0 && header.seq >= until_seq) {
+            break;  // οι εγγραφες ειναι σε σειρα seq
+        }
+
+        msg.text[header.length] = '\0';
+        msg.seq = header.seq;
+        msg.sender_pid = (pid_t) header.sender_pid;
+
+        callback(&msg, ctx);
+        replayed++;
+    }
+
+    fclose(file);
+    return replayed;
+}
@@ -0,0 +1,366 @@
+/*
+ * journal_daemon.c - Καταγραφη διαλογων στο δισκο και replay
+ *
+ * Εγγραφη:  dialog_journal [-D dir] -a
+ *           dialog_journal [-D dir] dialog_id...
+ * Replay:   dialog_journal [-D dir] -r dialog_id [-s from_seq]
+ *
+ * Στην εγγραφη η διεργασια συμμετεχει στους διαλογους σαν παρατηρητης
+ * (πιανει μια θεση συμμετεχοντα, αλλα δεν κραταει τον διαλογο ανοιχτο
+ * οταν φυγουν τα μελη του). Ο receiver μονο αντιγραφει
+ * τα μηνυματα σε buffers, ενας flusher thread τα γραφει με group commit.
+ * Ετσι το send_msg δεν περιμενει ποτε τον δισκο.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "types.h"
+#include "shm_manager.h"
+#include "dialog_ops.h"
+#include "messaging.h"
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define RECEIVE_BATCH 32
+#define POLL_INTERVAL_US 2000
+#define COMMIT_INTERVAL_US 5000
+
+// Καθε ποσους γυρους αποσυρονται οι νεκροι συμμετεχοντες (~1s), ωστε οι
+// διαλογοι που εμειναν μονο με παρατηρητες να κλεινουν κι αν δεν μεινει κανεις αλλος
+#define REAP_EVERY_N_POLLS 500
+
+// Με -a: αναμονη πριν ξαναδοκιμασω εναν διαλογο που ηταν γεματος
+#define RETRY_MIN_MS 100
+#define RETRY_MAX_MS 5000
+
+// Καταγραφη ανα διαλογο
+typedef struct {
+    int used;
+    JournalWriter writer;
+} FollowedDialog;
+
+// Διαλογος που δεν καταγραφεται τωρα, αλλα δεν πρεπει να ξαναδοκιμαστει αμεσως
+typedef struct {
+    int dialog_id;
+    int finished;                 // ελαβα TERMINATE - ποτε ξανα
+    unsigned long long retry_at;  // αλλιως: ms μετα απο αποτυχια συμμετοχης
+    unsigned int delay_ms;
+} SkippedDialog;
+
+static FollowedDialog followed[MAX_DIALOGS];
+static SkippedDialog skipped[MAX_DIALOGS];
+static int skipped_count = 0;
+static pthread_mutex_t followed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t keep_running = 1;
+static volatile int receiver_done = 0;
+
+static void handle_signal(int sig) {
+    (void) sig;
+    keep_running = 0;
+}
+
+static unsigned long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static SkippedDialog* find_skipped(int dialog_id) {
+    for (int i = 0; i < skipped_count; i++) {
+        if (skipped[i].dialog_id == dialog_id) {
+            return &skipped[i];
+        }
+    }
+    return NULL;
+}
+
+static SkippedDialog* add_skipped(int dialog_id) {
+    SkippedDialog* entry = find_skipped(dialog_id);
+    if (entry == NULL && skipped_count < MAX_DIALOGS) {
+        entry = &skipped[skipped_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->dialog_id = dialog_id;
+    }
+    return entry;
+}
+
+/*
+ * Flusher thread: καθε COMMIT_INTERVAL_US κανει commit οτι μαζευτηκε
+ */
+static void* flusher_thread(void* arg) {
+    (void) arg;
+
+    for (;;) {
+        int last_round = receiver_done;
+
+        pthread_mutex_lock(&followed_mutex);
+        for (int i = 0; i < MAX_DIALOGS; i++) {
+            if (followed[i].used) {
+                journal_commit(&followed[i].writer);
+            }
+        }
+        pthread_mutex_unlock(&followed_mutex);
+
+        if (last_round) break;
+        usleep(COMMIT_INTERVAL_US);
+    }
+
+    return NULL;
+}
+
+/*
+ * Ξεκιναει την καταγραφη ενος διαλογου
+ */
+static int follow_dialog(SharedMemoryData* memory, const char* dir, int dialog_id) {
+    int free_index = -1;
+    for (int i = 0; i < MAX_DIALOGS; i++) {
+        if (followed[i].used && followed[i].writer.dialog_id == dialog_id) {
+            return 0;
+        }
+        if (!followed[i].used && free_index == -1) {
+            free_index = i;
+        }
+    }
+
+    if (free_index == -1 || observe_dialog(memory, dialog_id) < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&followed_mutex);
+    if (journal_open(&followed[free_index].writer, dir, dialog_id, memory->instance_tag) < 0) {
+        pthread_mutex_unlock(&followed_mutex);
+        leave_dialog(memory, dialog_id);
+        return -1;
+    }
+    followed[free_index].used = 1;
+    pthread_mutex_unlock(&followed_mutex);
+
+    printf("Καταγραφη διαλογου %d\n", dialog_id);
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * Τελος καταγραφης ενος διαλογου: κλεινει το αρχειο και ελευθερωνει τη θεση
+ */
+static void unfollow_dialog(SharedMemoryData* memory, FollowedDialog* entry) {
+    int dialog_id = entry->writer.dialog_id;
+
+    pthread_mutex_lock(&followed_mutex);
+    journal_close(&entry->writer);
+    entry->used = 0;
+    pthread_mutex_unlock(&followed_mutex);
+
+    leave_dialog(memory, dialog_id);
+}
+
+/*
+ * Με -a: ξεκιναει καταγραφη για καθε ενεργο διαλογο που δεν παρακολουθειται
+ * Οσοι τελειωσαν δεν ξαναπιανονται, οσοι ηταν γεματοι ξαναδοκιμαζονται
+ * με εκθετικη αναμονη, ωστε να μην προσπαθω καθε POLL_INTERVAL_US.
+ */
+static void follow_new_dialogs(SharedMemoryData* memory, const char* dir) {
+    int ids[MAX_DIALOGS];
+    int count = 0;
+
+    lock_memory(memory);
+    for (int d = 0; d < MAX_DIALOGS; d++) {
+        if (memory->all_dialogs[d].active) {
+            ids[count++] = memory->all_dialogs[d].dialog_id;
+        }
+    }
+    unlock_memory(memory);
+
+    // Οσοι εκλεισαν βγαινουν απο τη λιστα (τα IDs δεν ξαναχρησιμοποιουνται)
+    for (int i = 0; i < skipped_count;) {
+        int still_active = 0;
+        for (int j = 0; j < count; j++) {
+            if (ids[j] == skipped[i].dialog_id) {
+                still_active = 1;
+                break;
+            }
+        }
+        if (still_active) {
+            i++;
+        } else {
+            skipped[i] = skipped[--skipped_count];
+        }
+    }
+
+    unsigned long long now = now_ms();
+    for (int i = 0; i < count; i++) {
+        SkippedDialog* entry = find_skipped(ids[i]);
+        if (entry != NULL && (entry->finished || now < entry->retry_at)) {
+            continue;
+        }
+
+        if (follow_dialog(memory, dir, ids[i]) == 0) {
+            if (entry != NULL) {
+                *entry = skipped[--skipped_count];
+            }
+            continue;
+        }
+
+        entry = add_skipped(ids[i]);
+        if (entry != NULL) {
+            entry->delay_ms = (entry->delay_ms == 0) ? RETRY_MIN_MS : entry->delay_ms * 2;
+            if (entry->delay_ms > RETRY_MAX_MS) {
+                entry->delay_ms = RETRY_MAX_MS;
+            }
+            entry->retry_at = now + entry->delay_ms;
+        }
+    }
+}
+
+/*
+ * Τυπωνει ενα μηνυμα του replay
+ */
+static void print_replayed(const ReceivedMessage* msg, void* ctx) {
+    (void) ctx;
+    printf("#%lu [PID %d]: %s\n", msg->seq, (int) msg->sender_pid, msg->text);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Χρηση: %s [-D dir] -a | dialog_id...\n"
+            "       %s [-D dir] -r dialog_id [-s from_seq]\n", prog, prog);
+}
+
+int main(int argc, char* argv[]) {
+    const char* dir = getenv("DIALOG_JOURNAL_DIR");
+    int follow_all = 0;
+    int replay_id = -1;
+    unsigned long from_seq = 0;
+    int opt;
+
+    if (dir == NULL) {
+        dir = JOURNAL_DEFAULT_DIR;
+    }
+
+    while ((opt = getopt(argc, argv, "D:ar:s:h")) != -1) {
+        switch (opt) {
+            case 'D': dir = optarg; break;
+            case 'a': follow_all = 1; break;
+            case 'r': replay_id = atoi(optarg); break;
+            case 's': from_seq = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    // Replay δεν χρειαζεται καθολου τη shared memory
+    if (replay_id >= 0) {
+        long count = journal_replay(dir, replay_id, from_seq, 0, 0, print_replayed, NULL);
+        if (count < 0) {
+            fprintf(stderr, "Δεν υπαρχει journal για τον διαλογο %d\n", replay_id);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!follow_all && optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    mkdir(dir, 0755);
+
+    SharedMemoryData* memory = connect_to_shared_memory(NULL, 0);
+    if (memory == NULL) {
+        fprintf(stderr, "Σφαλμα: Δεν υπαρχει ενεργο συστημα.\n");
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (follow_dialog(memory, dir, atoi(argv[i])) < 0) {
+            fprintf(stderr, "Αδυναμια καταγραφης διαλογου %s\n", argv[i]);
+        }
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    pthread_t flusher_tid;
+    pthread_create(&flusher_tid, NULL, flusher_thread, NULL);
+
+    ReceivedMessage batch[RECEIVE_BATCH];
+    int polls = 0;
+
+    while (keep_running) {
+        if (++polls % REAP_EVERY_N_POLLS == 0) {
+            lock_memory(memory);
+            reap_dead_participants(memory);
+            unlock_memory(memory);
+        }
+
+        if (follow_all) {
+            follow_new_dialogs(memory, dir);
+        }
+
+        int got_any = 0;
+        int still_open = 0;
+
+        for (int i = 0; i < MAX_DIALOGS; i++) {
+            if (!followed[i].used) continue;
+
+            int dialog_id = followed[i].writer.dialog_id;
+            int finished = 0;
+            int count;
+            do {
+                count = receive_msgs(memory, dialog_id, batch, RECEIVE_BATCH);
+                for (int m = 0; m < count; m++) {
+                    journal_append(&followed[i].writer, &batch[m]);
+                    if (strcmp(batch[m].text, "TERMINATE") == 0) {
+                        finished = 1;
+                    }
+                }
+                got_any |= count > 0;
+            } while (count == RECEIVE_BATCH && !finished);
+
+            // Ο διαλογος εκλεισε χωρις TERMINATE (εφυγαν ολα τα μελη)
+            if (count < 0) {
+                finished = 1;
+            }
+
+            if (finished) {
+                unfollow_dialog(memory, &followed[i]);
+
+                // Ο διαλογος μπορει να μενει ενεργος για τους αλλους - οχι ξανα απο την αρχη
+                SkippedDialog* entry = add_skipped(dialog_id);
+                if (entry != NULL) {
+                    entry->finished = 1;
+                }
+            } else {
+                still_open = 1;
+            }
+        }
+
+        // Χωρις -a τελειωνω οταν τερματιστουν ολοι οι διαλογοι μου
+        if (!follow_all && !still_open) {
+            break;
+        }
+
+        if (!got_any) {
+            usleep(POLL_INTERVAL_US);
+        }
+    }
+
+    receiver_done = 1;
+    pthread_join(flusher_tid, NULL);
+
+    // Αποχωρηση ωστε να μην κραταω μηνυματα στην ουρα
+    for (int i = 0; i < MAX_DIALOGS; i++) {
+        if (followed[i].used) {
+            unfollow_dialog(memory, &followed[i]);
+        }
+    }
+
+    disconnect_from_shared_memory(memory);
+    return 0;
+}
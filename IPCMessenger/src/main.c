@@ -4,10 +4,13 @@
  * Το interface με το χρηστη και η διαχειριση του receiver thread
  */
 
+#define _DEFAULT_SOURCE
+
 #include "types.h"
 #include "shm_manager.h"
 #include "dialog_ops.h"
 #include "messaging.h"
+#include "journal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,8 +20,12 @@
 // Καθολικες μεταβλητες που χρειαζεται το thread
 static SharedMemoryData* global_memory = NULL;
 static int current_dialog_id = -1;
+static unsigned long join_seq = 0;  // τα μηνυματα πριν απο αυτο ειναι ιστορικο
 static volatile int keep_running = 1;
 
+// Καθε ποσους γυρους του receiver γινεται ελεγχος για νεκρους συμμετεχοντες (~5s)
+#define REAP_EVERY_N_POLLS 25
+
 // Mutex για να μην μπερδευονται τα prints
 pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -27,10 +34,18 @@ pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
  */
 void* message_receiver_thread(void* arg) {
     (void)arg;  // δεν το χρησιμοποιω
+    int polls = 0;
     
     while (keep_running) {
+        // Περιοδικα αποσυρονται οσοι εφυγαν χωρις TERMINATE (π.χ. crash)
+        if (++polls % REAP_EVERY_N_POLLS == 0) {
+            lock_memory(global_memory);
+            reap_dead_participants(global_memory);
+            unlock_memory(global_memory);
+        }
+        
         // Ελεγχος για νεα μηνυματα
-        int terminated = check_and_receive_messages(global_memory, current_dialog_id);
+        int terminated = check_and_receive_messages(global_memory, current_dialog_id, join_seq);
         
         if (terminated) {
             pthread_mutex_lock(&output_mutex);
@@ -78,7 +93,7 @@ void read_text(char* buffer, int max_size) {
  * Εμφανιζει τους διαθεσιμους διαλογους
  */
 void show_available_dialogs(SharedMemoryData* memory) {
-    lock_memory();
+    lock_memory(memory);
     
     printf("\n=== Διαθεσιμοι Διαλογοι ===\n");
     int found_any = 0;
@@ -96,7 +111,15 @@ void show_available_dialogs(SharedMemoryData* memory) {
         printf("  (Κανενας ενεργος διαλογος)\n");
     }
     
-    unlock_memory();
+    unlock_memory(memory);
+}
+
+/*
+ * Εμφανιζει ενα μηνυμα απο το ιστορικο του journal
+ */
+void print_history_message(const ReceivedMessage* msg, void* ctx) {
+    (void)ctx;
+    printf("  #%lu [PID %d]: %s\n", msg->seq, msg->sender_pid, msg->text);
 }
 
 int main() {
@@ -118,11 +141,11 @@ int main() {
         // Δημιουργια νεου διαλογου
         
         // Πρωτα προσπαθω να συνδεθω (μηπως υπαρχει ηδη)
-        global_memory = connect_to_shared_memory(0);
+        global_memory = connect_to_shared_memory(NULL, 0);
         
         // Αν δεν υπαρχει, τη δημιουργω
         if (global_memory == NULL) {
-            global_memory = connect_to_shared_memory(1);
+            global_memory = connect_to_shared_memory(NULL, 1);
             if (global_memory == NULL) {
                 fprintf(stderr, "Σφαλμα: Αδυναμια δημιουργιας shared memory.\n");
                 return 1;
@@ -142,7 +165,7 @@ int main() {
     } else if (choice == 2) {
         // Συμμετοχη σε υπαρχοντα
         
-        global_memory = connect_to_shared_memory(0);
+        global_memory = connect_to_shared_memory(NULL, 0);
         if (global_memory == NULL) {
             fprintf(stderr, "Σφαλμα: Δεν υπαρχει ενεργο συστημα.\n");
             return 1;
@@ -155,7 +178,7 @@ int main() {
         
         current_dialog_id = read_number();
         
-        if (participate_in_dialog(global_memory, current_dialog_id) < 0) {
+        if (participate_in_dialog(global_memory, current_dialog_id, &join_seq) < 0) {
             fprintf(stderr, "Σφαλμα: Αποτυχια συμμετοχης.\n");
             disconnect_from_shared_memory(global_memory);
             return 1;
@@ -163,6 +186,16 @@ int main() {
         
         printf("\nΣυμμετεχετε στον διαλογο %d\n", current_dialog_id);
         
+        // Αν τρεχει το dialog_journal, ο νεος συμμετεχων βλεπει και το ιστορικο
+        const char* journal_dir = getenv("DIALOG_JOURNAL_DIR");
+        if (journal_dir != NULL) {
+            printf("\n=== Ιστορικο διαλογου ===\n");
+            if (journal_replay(journal_dir, current_dialog_id, 0, join_seq, global_memory->instance_tag,
+                               print_history_message, NULL) <= 0) {
+                printf("  (Κενο ιστορικο)\n");
+            }
+        }
+        
     } else {
         printf("Μη εγκυρη επιλογη.\n");
         return 1;
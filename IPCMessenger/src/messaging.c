@@ -8,85 +8,137 @@
 #include "messaging.h"
 #include "dialog_ops.h"
 #include "shm_manager.h"
+#include "metrics.h"
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+// Ποσα μηνυματα διαβαζει το check_and_receive_messages σε καθε γυρο
+#define RECEIVE_BATCH_SIZE 32
+
 /*
  * Στελνει ενα μηνυμα στον διαλογο
  * Επιστρεφει 0 σε επιτυχια, -1 σε αποτυχια
  */
 int send_msg(SharedMemoryData* memory, int dialog_id, const char* message_text) {
-    lock_memory();
+    const char* msgs[1] = { message_text };
+    
+    int sent = send_msgs(memory, dialog_id, msgs, 1);
+    if (sent == 0) {
+        fprintf(stderr, "Η ουρα μηνυματων ειναι γεματη!\n");
+    }
+    
+    return (sent == 1) ? 0 : -1;
+}
+
+/*
+ * Στελνει πολλα μηνυματα στον διαλογο με ενα μονο lock
+ * Ο διαλογος βρισκεται μια φορα και η αναζητηση κενης θεσης
+ * συνεχιζει απο εκει που σταματησε το προηγουμενο μηνυμα.
+ * Επιστρεφει ποσα μηνυματα σταλθηκαν (λιγοτερα αν γεμισε η ουρα,
+ * χωρις μηνυμα λαθους - το χειριζεται ο καλων), -1 αν δεν βρεθηκε ο διαλογος
+ */
+int send_msgs(SharedMemoryData* memory, int dialog_id, const char* const msgs[], int count) {
+    pid_t my_pid = getpid();
+    int sent = 0;
+    int slot = 0;
+    int reaped = 0;
+    
+    // Χρονος αποστολης για το latency - εκτος του critical section
+    unsigned long long sent_ns = metrics_now_ns();
+    
+    lock_memory(memory);
     
     // Βρισκω τον διαλογο
     DialogInfo* dialog = get_dialog_by_id(memory, dialog_id);
     if (dialog == NULL) {
-        unlock_memory();
+        unlock_memory(memory);
         fprintf(stderr, "Αποτυχια αποστολης: δεν βρεθηκε ο διαλογος\n");
         return -1;
     }
     
-    // Ψαχνω για κενη θεση στην ουρα μηνυματων
-    int empty_slot = -1;
-    for (int i = 0; i < MAX_MSGS_IN_QUEUE; i++) {
-        if (memory->message_queue[i].occupied == 0) {
-            empty_slot = i;
+    for (sent = 0; sent < count; sent++) {
+        // Ψαχνω για κενη θεση στην ουρα μηνυματων
+        while (slot < MAX_MSGS_IN_QUEUE && memory->message_queue[slot].occupied) {
+            slot++;
+        }
+        
+        // Γεματη ουρα: μια φορα ανα κληση ψαχνω για θεσεις νεκρων συμμετεχοντων
+        if (slot == MAX_MSGS_IN_QUEUE && !reaped && dialog->active) {
+            reaped = 1;
+            reap_dead_participants(memory);
+            slot = 0;
+            while (slot < MAX_MSGS_IN_QUEUE && memory->message_queue[slot].occupied) {
+                slot++;
+            }
+        }
+        
+        if (slot == MAX_MSGS_IN_QUEUE || !dialog->active) {
             break;
         }
+        
+        // Δημιουργια του μηνυματος
+        MessageEntry* new_msg = &memory->message_queue[slot];
+        new_msg->occupied = 1;
+        new_msg->belongs_to_dialog = dialog_id;
+        new_msg->sender_pid = my_pid;
+        new_msg->seq = dialog->next_seq++;
+        new_msg->sent_ns = sent_ns;
+        
+        strncpy(new_msg->text, msgs[sent], MSG_TEXT_SIZE - 1);
+        new_msg->text[MSG_TEXT_SIZE - 1] = '\0';
+        
+        // Κανενας δεν το εχει διαβασει ακομα
+        for (int i = 0; i < dialog->participant_count; i++) {
+            new_msg->has_been_read[i] = 0;
+        }
+        metrics_queue_push(memory);
     }
     
-    if (empty_slot == -1) {
-        unlock_memory();
-        fprintf(stderr, "Η ουρα μηνυματων ειναι γεματη!\n");
-        return -1;
-    }
-    
-    // Δημιουργια του μηνυματος
-    MessageEntry* new_msg = &memory->message_queue[empty_slot];
-    new_msg->occupied = 1;
-    new_msg->belongs_to_dialog = dialog_id;
-    new_msg->sender_pid = getpid();
-    
-    strncpy(new_msg->text, message_text, MSG_TEXT_SIZE - 1);
-    new_msg->text[MSG_TEXT_SIZE - 1] = '\0';
-    
-    // Κανενας δεν το εχει διαβασει ακομα
-    for (int i = 0; i < dialog->participant_count; i++) {
-        new_msg->has_been_read[i] = 0;
+    DialogMetrics* metrics = &memory->metrics.dialogs[dialog - memory->all_dialogs];
+    metrics->sent += sent;
+    if (sent < count) {
+        metrics->queue_full++;
     }
     
-    unlock_memory();
+    unlock_memory(memory);
     
-    return 0;
+    return sent;
 }
 
 /*
- * Ελεγχει για νεα μηνυματα και τα διαβαζει
- * Επιστρεφει 1 αν ελαβε TERMINATE, 0 αλλιως
+ * Διαβαζει μεχρι max_count νεα μηνυματα του διαλογου στον πινακα out
+ * Μεσα στο lock γινεται μονο η αντιγραφη και το bookkeeping,
+ * η εκτυπωση ειναι δουλεια του καλουντα.
+ * Επιστρεφει ποσα μηνυματα αντιγραφηκαν, -1 αν ο διαλογος εκλεισε
+ * η δεν συμμετεχω σε αυτον
  */
-int check_and_receive_messages(SharedMemoryData* memory, int dialog_id) {
+int receive_msgs(SharedMemoryData* memory, int dialog_id, ReceivedMessage out[], int max_count) {
     int got_terminate = 0;
+    int received = 0;
     pid_t my_pid = getpid();
     
-    lock_memory();
+    lock_memory(memory);
     
     // Βρισκω τον διαλογο μου
     DialogInfo* my_dialog = get_dialog_by_id(memory, dialog_id);
     if (my_dialog == NULL) {
-        unlock_memory();
-        return 0;
+        unlock_memory(memory);
+        return -1;
     }
     
-    // Βρισκω τη θεση μου στον πινακα συμμετεχοντων
-    int my_index = find_participant_index(my_dialog, my_pid);
+    // Η θεση μου στον πινακα συμμετεχοντων (απο την cache του join)
+    int my_index = my_participant_index(memory, my_dialog, my_pid);
     if (my_index == -1) {
-        unlock_memory();
-        return 0;
+        unlock_memory(memory);
+        return -1;
     }
     
-    // Διατρεχω ολα τα μηνυματα
-    for (int i = 0; i < MAX_MSGS_IN_QUEUE; i++) {
+    DialogMetrics* metrics = &memory->metrics.dialogs[my_dialog - memory->all_dialogs];
+    unsigned long long now_ns = 0;
+    
+    // Διατρεχω τα μηνυματα μεχρι να γεμισει ο πινακας του καλουντα
+    for (int i = 0; i < MAX_MSGS_IN_QUEUE && received < max_count; i++) {
         MessageEntry* msg = &memory->message_queue[i];
         
         // Αν δεν υπαρχει μηνυμα, συνεχισε
@@ -98,48 +150,52 @@ int check_and_receive_messages(SharedMemoryData* memory, int dialog_id) {
         // Αν το εχω ηδη διαβασει, συνεχισε
         if (msg->has_been_read[my_index]) continue;
         
-        // Εμφανιση του μηνυματος
-        printf("\n>>> [Νεο μηνυμα απο PID %d]: %s\n", msg->sender_pid, msg->text);
-        fflush(stdout);
+        // Αντιγραφη του μηνυματος για τον καλουντα
+        out[received].sender_pid = msg->sender_pid;
+        out[received].seq = msg->seq;
+        memcpy(out[received].text, msg->text, MSG_TEXT_SIZE);
+        received++;
         
         // Σημειωση οτι το διαβασα
         msg->has_been_read[my_index] = 1;
         
+        // Ενα clock_gettime ανα κληση, μονο αν υπαρχει κατι να παραδοθει
+        if (now_ns == 0) {
+            now_ns = metrics_now_ns();
+        }
+        metrics_record_latency(metrics, now_ns > msg->sent_ns ? now_ns - msg->sent_ns : 0);
+        
         // Ελεγχος για TERMINATE
         if (strcmp(msg->text, "TERMINATE") == 0) {
             got_terminate = 1;
             my_dialog->participants[my_index].is_active = 0;
         }
         
-        // Ελεγχος αν ολοι οι ενεργοι συμμετεχοντες το διαβασαν
-        int everyone_read_it = 1;
-        for (int p = 0; p < my_dialog->participant_count; p++) {
-            // Αν ειναι ενεργος και δεν το διαβασε
-            if (my_dialog->participants[p].is_active && !msg->has_been_read[p]) {
-                everyone_read_it = 0;
-                break;
-            }
-        }
-        
-        // Αν ολοι το διαβασαν, διεγραψε το
-        if (everyone_read_it) {
+        // Αν ολοι οι ενεργοι συμμετεχοντες το διαβασαν, διεγραψε το
+        if (all_active_have_read(my_dialog, msg)) {
             msg->occupied = 0;
+            metrics_queue_pop(memory);
         }
     }
     
+    metrics->delivered += received;
+    
     // Αν ελαβα TERMINATE, ελεγξε αν ο διαλογος πρεπει να κλεισει
     if (got_terminate) {
-        int any_active = 0;
+        // Οι παρατηρητες δεν ειναι μελη, αλλα οσοι ειναι ακομα ενεργοι δεν εχουν
+        // διαβασει το TERMINATE: ο διαλογος κλεινει οταν το διαβασει και ο τελευταιος,
+        // ωστε το journal να μη χανει την ουρα του διαλογου
+        int observers_pending = 0;
         for (int p = 0; p < my_dialog->participant_count; p++) {
-            if (my_dialog->participants[p].is_active) {
-                any_active = 1;
+            if (my_dialog->participants[p].is_active && my_dialog->participants[p].is_observer) {
+                observers_pending = 1;
                 break;
             }
         }
         
-        // Αν δεν υπαρχουν ενεργοι συμμετεχοντες, κλεισε τον διαλογο
-        if (!any_active) {
-            my_dialog->active = 0;
+        // Αν δεν υπαρχουν ενεργα μελη, κλεισε τον διαλογο
+        if (!dialog_has_members(my_dialog) && !observers_pending) {
+            release_dialog(memory, my_dialog);
             
             // Ελεγχος αν υπαρχουν αλλοι ενεργοι διαλογοι
             int any_dialogs_left = 0;
@@ -152,14 +208,51 @@ int check_and_receive_messages(SharedMemoryData* memory, int dialog_id) {
             
             // Αν δεν υπαρχουν αλλοι διαλογοι, καθαρισμος
             if (!any_dialogs_left) {
-                unlock_memory();
-                cleanup_shared_memory();
-                return 1;
+                unlock_memory(memory);
+                cleanup_shared_memory(namespace_of(memory));
+                return received;
             }
         }
     }
     
-    unlock_memory();
+    unlock_memory(memory);
+    
+    return received;
+}
+
+/*
+ * Ελεγχει για νεα μηνυματα και τα διαβαζει
+ * Οσα εχουν seq < from_seq τα εδειξε ηδη το ιστορικο του join και παραλειπονται.
+ * Επιστρεφει 1 αν ελαβε TERMINATE, 0 αλλιως
+ */
+int check_and_receive_messages(SharedMemoryData* memory, int dialog_id, unsigned long from_seq) {
+    ReceivedMessage batch[RECEIVE_BATCH_SIZE];
+    int got_terminate = 0;
+    int count;
+    
+    do {
+        count = receive_msgs(memory, dialog_id, batch, RECEIVE_BATCH_SIZE);
+        
+        // Εμφανιση των μηνυματων εξω απο το lock
+        for (int i = 0; i < count; i++) {
+            // Το receive_msgs με εβγαλε ηδη απο τον διαλογο, οποτε μετραει κι αν δεν εμφανιστει
+            if (strcmp(batch[i].text, "TERMINATE") == 0) {
+                got_terminate = 1;
+            }
+            if (batch[i].seq < from_seq) continue;
+            
+            printf("\n>>> [Νεο μηνυμα απο PID %d]: %s\n", batch[i].sender_pid, batch[i].text);
+        }
+        
+        if (count > 0) {
+            fflush(stdout);
+        }
+    } while (count == RECEIVE_BATCH_SIZE && !got_terminate);
+    
+    // Ο διαλογος εκλεισε χωρις να δω TERMINATE (π.χ. τον αποσυρε ο reaper)
+    if (count < 0) {
+        got_terminate = 1;
+    }
     
     return got_terminate;
 }
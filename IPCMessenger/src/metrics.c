@@ -0,0 +1,74 @@
+/*
+ * metrics.c - Ενημερωση των μετρησεων στη shared memory
+ * 
+ * Το ιστογραμμα ειναι λογαριθμικο: ενα bucket για καθε δυναμη του 2,
+ * ωστε η καταγραφη να ειναι ενας πινακας και μια αυξηση.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "metrics.h"
+#include <string.h>
+#include <time.h>
+
+unsigned long long metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void metrics_reset_dialog(SharedMemoryData* memory, int slot, int dialog_id) {
+    DialogMetrics* dialog = &memory->metrics.dialogs[slot];
+    memset(dialog, 0, sizeof(*dialog));
+    dialog->dialog_id = dialog_id;
+}
+
+void metrics_queue_push(SharedMemoryData* memory) {
+    Metrics* metrics = &memory->metrics;
+    metrics->queue_depth++;
+    if (metrics->queue_depth > metrics->queue_high_water) {
+        metrics->queue_high_water = metrics->queue_depth;
+    }
+}
+
+void metrics_queue_pop(SharedMemoryData* memory) {
+    if (memory->metrics.queue_depth > 0) {
+        memory->metrics.queue_depth--;
+    }
+}
+
+/*
+ * Bucket = θεση του υψηλοτερου bit, με ολα τα μεγαλυτερα στο τελευταιο
+ */
+void metrics_record_latency(DialogMetrics* dialog, unsigned long long latency_ns) {
+    int bucket = 0;
+    while (latency_ns > 1 && bucket < LATENCY_BUCKETS - 1) {
+        latency_ns >>= 1;
+        bucket++;
+    }
+    dialog->latency[bucket]++;
+}
+
+unsigned long long metrics_latency_percentile(const DialogMetrics* dialog, double p) {
+    unsigned long total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        total += dialog->latency[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    
+    unsigned long target = (unsigned long) (p * (double) total);
+    if (target >= total) {
+        target = total - 1;
+    }
+    
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += dialog->latency[i];
+        if (seen > target) {
+            return 1ULL << (i + 1);
+        }
+    }
+    return 1ULL << LATENCY_BUCKETS;
+}
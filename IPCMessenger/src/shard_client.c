@@ -0,0 +1,116 @@
+/*
+ * shard_client.c - Δρομολογηση διαλογων σε shards με βαση το ID
+ * 
+ * Ο client δεν κραταει κατασταση για καθε διαλογο - το shard βγαινει
+ * απευθειας απο το global ID, αρα καθε διεργασια το υπολογιζει μονη της.
+ */
+
+#include "shard_client.h"
+#include "dialog_ops.h"
+#include "messaging.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Συνδεση σε ολα τα shards
+ * Επιστρεφει 0 σε επιτυχια, -1 σε αποτυχια (τοτε δεν μενει τιποτα συνδεδεμενο)
+ */
+int shard_client_connect(ShardClient* client, const ShmNamespace* base, int shard_count, int should_create) {
+    ShmNamespace resolved;
+    
+    if (shard_count < 1 || shard_count > MAX_SHARDS) {
+        fprintf(stderr, "Μη εγκυρος αριθμος shards: %d\n", shard_count);
+        return -1;
+    }
+    
+    if (base == NULL) {
+        default_namespace(&resolved);
+        base = &resolved;
+    }
+    
+    memset(client, 0, sizeof(*client));
+    client->shard_count = shard_count;
+    
+    // Διαφορετικες διεργασιες ξεκινανε απο διαφορετικο shard
+    client->next_shard = (int) (getpid() % shard_count);
+    
+    for (int i = 0; i < shard_count; i++) {
+        shard_namespace(&client->namespaces[i], base, i);
+        client->shards[i] = connect_to_shared_memory(&client->namespaces[i], should_create);
+        if (client->shards[i] == NULL) {
+            shard_client_disconnect(client);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/*
+ * Αποσυνδεση απο ολα τα shards
+ */
+void shard_client_disconnect(ShardClient* client) {
+    for (int i = 0; i < client->shard_count; i++) {
+        disconnect_from_shared_memory(client->shards[i]);
+        client->shards[i] = NULL;
+    }
+}
+
+/*
+ * Καταστροφη ολων των shards απο το συστημα
+ */
+void shard_client_cleanup(ShardClient* client) {
+    for (int i = 0; i < client->shard_count; i++) {
+        cleanup_shared_memory(&client->namespaces[i]);
+    }
+}
+
+/*
+ * Μετατροπη global ID σε (shard, τοπικο ID)
+ */
+SharedMemoryData* shard_for_dialog(ShardClient* client, int global_id, int* local_id) {
+    if (global_id < 0) {
+        return NULL;
+    }
+    
+    *local_id = global_id / client->shard_count;
+    return client->shards[global_id % client->shard_count];
+}
+
+/*
+ * Δημιουργει νεο διαλογο στο επομενο shard - επιστρεφει το global ID η -1
+ */
+int shard_start_new_dialog(ShardClient* client) {
+    for (int attempt = 0; attempt < client->shard_count; attempt++) {
+        int shard = client->next_shard;
+        client->next_shard = (client->next_shard + 1) % client->shard_count;
+        
+        int local_id = start_new_dialog(client->shards[shard]);
+        if (local_id >= 0) {
+            return local_id * client->shard_count + shard;
+        }
+    }
+    return -1;
+}
+
+int shard_participate_in_dialog(ShardClient* client, int global_id) {
+    int local_id;
+    SharedMemoryData* memory = shard_for_dialog(client, global_id, &local_id);
+    
+    return (memory != NULL) ? participate_in_dialog(memory, local_id, NULL) : -1;
+}
+
+int shard_send_msgs(ShardClient* client, int global_id, const char* const msgs[], int count) {
+    int local_id;
+    SharedMemoryData* memory = shard_for_dialog(client, global_id, &local_id);
+    
+    return (memory != NULL) ? send_msgs(memory, local_id, msgs, count) : -1;
+}
+
+int shard_receive_msgs(ShardClient* client, int global_id, ReceivedMessage out[], int max_count) {
+    int local_id;
+    SharedMemoryData* memory = shard_for_dialog(client, global_id, &local_id);
+    
+    return (memory != NULL) ? receive_msgs(memory, local_id, out, max_count) : -1;
+}
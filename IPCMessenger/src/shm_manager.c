@@ -3,8 +3,14 @@
  * 
  * Χρησιμοποιω System V shared memory (shmget, shmat κλπ) και
  * POSIX named semaphores για το synchronization.
+ * 
+ * Καθε namespace (key + ονομα semaphore) ειναι ενα ανεξαρτητο συστημα
+ * με δικο του segment και δικο του lock. Μια διεργασια μπορει να ειναι
+ * συνδεδεμενη σε πολλα ταυτοχρονα (βλ. shard_client.c).
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "shm_manager.h"
 #include <sys/shm.h>
 #include <semaphore.h>
@@ -12,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 // Το key για τη shared memory - χρησιμοποιω κατι τυχαιο
 #define SHARED_MEM_KEY 0x5A7B
@@ -19,24 +27,123 @@
 // Ονομα για το semaphore
 #define SEM_NAME "/dialog_sem_lock"
 
+// Μεταβλητες περιβαλλοντος που αλλαζουν τα παραπανω (π.χ. δυο segments στο ιδιο host)
+#define SHM_KEY_ENV "DIALOG_SHM_KEY"
+#define SEM_NAME_ENV "DIALOG_SEM_NAME"
+
+// Αποσταση των keys διαδοχικων shards: με base + index το shard 1 του
+// 0x5A7B θα ηταν το 0x5A7C, δηλαδη το key που διαλεγει κανεις για ενα
+// δευτερο, ανεξαρτητο συστημα (π.χ. στο παραδειγμα του bridge)
+#define SHARD_KEY_STRIDE 0x10000
+
+// Ποσα segments μπορει να εχει ανοιχτα μια διεργασια
+#define MAX_ATTACHED_INSTANCES 16
+
+/*
+ * Ενα segment στο οποιο εχει συνδεθει η διεργασια
+ */
+typedef struct {
+    SharedMemoryData* memory;
+    sem_t* semaphore;
+    ShmNamespace ns;
+} AttachedInstance;
+
 // Στατικες μεταβλητες για το module
-static sem_t* semaphore = NULL;
-static int shm_id = -1;
+// (οι __thread ειναι ανα thread: ο main και ο receiver thread κλειδωνουν ταυτοχρονα)
+static AttachedInstance instances[MAX_ATTACHED_INSTANCES];
+static __thread AttachedInstance* last_instance = NULL;
+
+// Μετρησεις του lock (ενημερωνονται μονο με IPC_LOCK_STATS)
+// Το lock_stats αλλαζει μονο οσο κρατιεται το semaphore, αρα δεν χρειαζεται αλλο lock.
+static LockStats lock_stats;
+#ifdef IPC_LOCK_STATS
+static __thread unsigned long long lock_acquired_at = 0;
+#endif
+
+// Μετρητης κλειδωματων του thread για τη δειγματοληψια του Metrics
+static __thread unsigned int lock_calls = 0;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Το προεπιλεγμενο namespace - απο το περιβαλλον αν οριστηκε
+ */
+void default_namespace(ShmNamespace* ns) {
+    const char* key = getenv(SHM_KEY_ENV);
+    const char* name = getenv(SEM_NAME_ENV);
+    
+    ns->key = (key != NULL && *key != '\0') ? (int) strtol(key, NULL, 0) : SHARED_MEM_KEY;
+    snprintf(ns->sem_name, sizeof(ns->sem_name), "%s",
+             (name != NULL && *name != '\0') ? name : SEM_NAME);
+}
+
+/*
+ * Το namespace του shard με αριθμο index, με βαση το base
+ * Το shard 0 ειναι το ιδιο το base, ωστε ενα shard να ισοδυναμει με το απλο συστημα.
+ * Τα υπολοιπα απεχουν SHARD_KEY_STRIDE, ωστε να μην πεφτουν σε γειτονικα keys.
+ */
+void shard_namespace(ShmNamespace* ns, const ShmNamespace* base, int index) {
+    ns->key = (int) ((unsigned int) base->key + (unsigned int) index * SHARD_KEY_STRIDE);
+    if (index == 0) {
+        snprintf(ns->sem_name, sizeof(ns->sem_name), "%s", base->sem_name);
+    } else {
+        snprintf(ns->sem_name, sizeof(ns->sem_name), "%.*s_%d",
+                 (int) sizeof(ns->sem_name) - 12, base->sem_name, index);
+    }
+}
+
+/*
+ * Βρισκει τα στοιχεια συνδεσης για ενα segment
+ */
+static AttachedInstance* find_instance(const SharedMemoryData* memory) {
+    // Σχεδον παντα ζητειται το ιδιο segment με την προηγουμενη φορα
+    AttachedInstance* last = last_instance;
+    if (last != NULL && last->memory == memory) {
+        return last;
+    }
+    
+    for (int i = 0; i < MAX_ATTACHED_INSTANCES; i++) {
+        if (instances[i].memory == memory) {
+            if (memory != NULL) {
+                last_instance = &instances[i];
+            }
+            return &instances[i];
+        }
+    }
+    return NULL;
+}
 
 /*
  * Συνδεεται στη shared memory (η τη δημιουργει αν χρειαζεται)
  * 
+ * ns: ποιο συστημα (NULL = το προεπιλεγμενο)
  * should_create: 1 = δημιουργησε τη αν δεν υπαρχει, 0 = μονο συνδεση
  */
-SharedMemoryData* connect_to_shared_memory(int should_create) {
+SharedMemoryData* connect_to_shared_memory(const ShmNamespace* ns, int should_create) {
+    ShmNamespace resolved;
     int flags = 0666;  // permissions
     
+    if (ns == NULL) {
+        default_namespace(&resolved);
+        ns = &resolved;
+    }
+    
+    AttachedInstance* slot = find_instance(NULL);
+    if (slot == NULL) {
+        fprintf(stderr, "Πολλες ταυτοχρονες συνδεσεις shared memory!\n");
+        return NULL;
+    }
+    
     if (should_create) {
         flags |= IPC_CREAT;
     }
     
     // Προσπαθεια να παρω/δημιουργησω το shared memory segment
-    shm_id = shmget(SHARED_MEM_KEY, sizeof(SharedMemoryData), flags);
+    int shm_id = shmget((key_t) ns->key, sizeof(SharedMemoryData), flags);
     if (shm_id < 0) {
         perror("Αποτυχια shmget");
         return NULL;
@@ -50,12 +157,13 @@ SharedMemoryData* connect_to_shared_memory(int should_create) {
     }
     
     // Ανοιγμα η δημιουργια του semaphore
+    sem_t* semaphore;
     if (should_create) {
         // Δημιουργω νεο semaphore με αρχικη τιμη 1 (unlocked)
-        semaphore = sem_open(SEM_NAME, O_CREAT, 0666, 1);
+        semaphore = sem_open(ns->sem_name, O_CREAT, 0666, 1);
     } else {
         // Απλα ανοιγω το υπαρχον
-        semaphore = sem_open(SEM_NAME, 0);
+        semaphore = sem_open(ns->sem_name, 0);
     }
     
     if (semaphore == SEM_FAILED) {
@@ -64,9 +172,13 @@ SharedMemoryData* connect_to_shared_memory(int should_create) {
         return NULL;
     }
     
+    slot->memory = mem_ptr;
+    slot->semaphore = semaphore;
+    slot->ns = *ns;
+    
     // Αν ειναι νεα shared memory, την αρχικοποιω
     if (should_create) {
-        lock_memory();
+        lock_memory(mem_ptr);
         
         // Μηδενισμος ολων των δομων
         mem_ptr->next_available_id = 1;
@@ -80,7 +192,29 @@ SharedMemoryData* connect_to_shared_memory(int should_create) {
             mem_ptr->message_queue[i].occupied = 0;
         }
         
-        unlock_memory();
+        for (int i = 0; i < DIALOG_HASH_SIZE; i++) {
+            mem_ptr->dialog_hash[i] = DIALOG_HASH_EMPTY;
+        }
+        
+        mem_ptr->next_topic_generation = 1;
+        
+        for (int i = 0; i < MAX_TOPICS; i++) {
+            mem_ptr->all_topics[i].active = 0;
+        }
+        
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            mem_ptr->subscribers[i].in_use = 0;
+        }
+        
+        memset(&mem_ptr->metrics, 0, sizeof(mem_ptr->metrics));
+        
+        // Τα IDs ξαναξεκινανε απο 1, οποτε το journal ξεχωριζει τις εκτελεσεις με αυτο
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        mem_ptr->instance_tag = ((unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec)
+                                ^ ((unsigned long long) getpid() << 40);
+        
+        unlock_memory(mem_ptr);
     }
     
     return mem_ptr;
@@ -90,42 +224,104 @@ SharedMemoryData* connect_to_shared_memory(int should_create) {
  * Αποσυνδεση απο τη shared memory
  */
 void disconnect_from_shared_memory(SharedMemoryData* mem_ptr) {
-    if (mem_ptr != NULL) {
-        shmdt(mem_ptr);
+    if (mem_ptr == NULL) {
+        return;
     }
     
-    if (semaphore != NULL) {
-        sem_close(semaphore);
+    AttachedInstance* instance = find_instance(mem_ptr);
+    shmdt(mem_ptr);
+    
+    if (instance != NULL) {
+        sem_close(instance->semaphore);
+        instance->memory = NULL;
+        instance->semaphore = NULL;
     }
 }
 
+/*
+ * Το namespace στο οποιο ανηκει ενα συνδεδεμενο segment
+ */
+const ShmNamespace* namespace_of(const SharedMemoryData* memory) {
+    AttachedInstance* instance = find_instance(memory);
+    return (instance != NULL) ? &instance->ns : NULL;
+}
+
 /*
  * Καταστροφη της shared memory απο το συστημα
  * (να καλειται μονο οταν τελειωσουν ολες οι διεργασιες)
+ * 
+ * ns: ποιο συστημα (NULL = το προεπιλεγμενο)
  */
-void cleanup_shared_memory(void) {
-    int id = shmget(SHARED_MEM_KEY, sizeof(SharedMemoryData), 0666);
+void cleanup_shared_memory(const ShmNamespace* ns) {
+    ShmNamespace resolved;
+    
+    if (ns == NULL) {
+        default_namespace(&resolved);
+        ns = &resolved;
+    }
+    
+    int id = shmget((key_t) ns->key, sizeof(SharedMemoryData), 0666);
     if (id >= 0) {
         shmctl(id, IPC_RMID, NULL);
     }
     
-    sem_unlink(SEM_NAME);
+    sem_unlink(ns->sem_name);
 }
 
 /*
  * Κλειδωμα της shared memory (critical section start)
  */
-void lock_memory(void) {
-    if (semaphore != NULL) {
-        sem_wait(semaphore);
+void lock_memory(SharedMemoryData* memory) {
+    AttachedInstance* instance = find_instance(memory);
+    
+    if (instance != NULL) {
+        // Το clock_gettime πληρωνεται μονο στα δειγματα (παντα με IPC_LOCK_STATS)
+        int sample = (++lock_calls % LOCK_WAIT_SAMPLE_EVERY) == 0;
+#ifdef IPC_LOCK_STATS
+        sample = 1;
+#endif
+        unsigned long long before = sample ? monotonic_ns() : 0;
+        
+        sem_wait(instance->semaphore);
+        
+        Metrics* metrics = &memory->metrics;
+        metrics->lock_acquisitions++;
+        if (sample) {
+            unsigned long long now = monotonic_ns();
+            unsigned long long wait = now - before;
+            
+            metrics->lock_wait_samples++;
+            metrics->lock_wait_ns += wait;
+            if (wait > metrics->lock_wait_max_ns) {
+                metrics->lock_wait_max_ns = wait;
+            }
+#ifdef IPC_LOCK_STATS
+            lock_acquired_at = now;
+            lock_stats.acquisitions++;
+            lock_stats.wait_ns += wait;
+#endif
+        }
     }
 }
 
 /*
  * Ξεκλειδωμα της shared memory (critical section end)
  */
-void unlock_memory(void) {
-    if (semaphore != NULL) {
-        sem_post(semaphore);
+void unlock_memory(SharedMemoryData* memory) {
+    AttachedInstance* instance = find_instance(memory);
+    
+    if (instance != NULL) {
+#ifdef IPC_LOCK_STATS
+        // Ενημερωση πριν το sem_post, οσο κρατω ακομα το lock
+        lock_stats.hold_ns += monotonic_ns() - lock_acquired_at;
+#endif
+        sem_post(instance->semaphore);
     }
 }
+
+/*
+ * Επιστρεφει τα στατιστικα του lock για αυτη τη διεργασια
+ */
+void get_lock_stats(LockStats* out) {
+    *out = lock_stats;
+}
@@ -0,0 +1,262 @@
+/*
+ * topics.c - Υλοποιηση publish/subscribe πανω σε κυκλικο log
+ * 
+ * Το ID ενος topic κωδικοποιει τη θεση του (id % MAX_TOPICS), οποτε
+ * η αναζητηση ειναι O(1). Το tail υπολογιζεται ξανα (ελαχιστο cursor)
+ * μονο οταν γεμισει το log, δηλαδη μια φορα ανα TOPIC_LOG_SIZE μηνυματα.
+ */
+
+#include "topics.h"
+#include "dialog_ops.h"
+#include "shm_manager.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Βρισκει ενα ενεργο topic με βαση το ID του
+ */
+static TopicInfo* get_topic_by_id(SharedMemoryData* memory, int topic_id) {
+    if (topic_id < 0) {
+        return NULL;
+    }
+    
+    TopicInfo* topic = &memory->all_topics[topic_id % MAX_TOPICS];
+    if (!topic->active || topic->topic_id != topic_id) {
+        return NULL;
+    }
+    return topic;
+}
+
+/*
+ * Το μικροτερο cursor των συνδρομητων ενος topic
+ */
+static unsigned long min_cursor(SharedMemoryData* memory, TopicInfo* topic) {
+    int slot = (int) (topic - memory->all_topics);
+    unsigned long minimum = topic->head;
+    
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber* sub = &memory->subscribers[i];
+        if (sub->in_use && sub->topic_slot == slot && sub->cursor < minimum) {
+            minimum = sub->cursor;
+        }
+    }
+    return minimum;
+}
+
+/*
+ * Ξαναϋπολογιζει το tail ως το μικροτερο cursor. Αν δεν προχωρησε,
+ * ελεγχεται αν ζουν οσοι το κρατανε πισω - οι νεκροι αποσυρονται.
+ * Ετσι το kill γινεται μονο για οσους μπλοκαρουν, οχι για ολους.
+ * Καλειται μεσα στο lock.
+ */
+static void advance_tail(SharedMemoryData* memory, TopicInfo* topic) {
+    int slot = (int) (topic - memory->all_topics);
+    unsigned long minimum = min_cursor(memory, topic);
+    
+    if (minimum == topic->tail) {
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            Subscriber* sub = &memory->subscribers[i];
+            if (!sub->in_use || sub->topic_slot != slot || sub->cursor != minimum) continue;
+            
+            if (!process_is_alive(sub->process_id)) {
+                sub->in_use = 0;
+                topic->subscriber_count--;
+            }
+        }
+        minimum = min_cursor(memory, topic);
+    }
+    
+    topic->tail = minimum;
+}
+
+/*
+ * Δημιουργει ενα νεο topic
+ * Επιστρεφει το ID του η -1 σε αποτυχια
+ */
+int topic_create(SharedMemoryData* memory) {
+    lock_memory(memory);
+    
+    int free_slot = -1;
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        if (!memory->all_topics[i].active) {
+            free_slot = i;
+            break;
+        }
+    }
+    
+    if (free_slot == -1) {
+        unlock_memory(memory);
+        fprintf(stderr, "Δεν υπαρχουν διαθεσιμες θεσεις για νεο topic!\n");
+        return -1;
+    }
+    
+    TopicInfo* topic = &memory->all_topics[free_slot];
+    topic->topic_id = memory->next_topic_generation * MAX_TOPICS + free_slot;
+    memory->next_topic_generation++;
+    topic->head = 1;
+    topic->tail = 1;
+    topic->subscriber_count = 0;
+    topic->active = 1;
+    
+    int created_id = topic->topic_id;
+    
+    unlock_memory(memory);
+    
+    return created_id;
+}
+
+/*
+ * Κλεινει ενα topic και αποσυρει ολους τους συνδρομητες του
+ */
+void topic_close(SharedMemoryData* memory, int topic_id) {
+    lock_memory(memory);
+    
+    TopicInfo* topic = get_topic_by_id(memory, topic_id);
+    if (topic != NULL) {
+        int slot = (int) (topic - memory->all_topics);
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            if (memory->subscribers[i].in_use && memory->subscribers[i].topic_slot == slot) {
+                memory->subscribers[i].in_use = 0;
+            }
+        }
+        topic->active = 0;
+    }
+    
+    unlock_memory(memory);
+}
+
+/*
+ * Εγγραφη συνδρομητη - βλεπει οτι δημοσιευτει απο εδω και περα
+ * Επιστρεφει το handle της συνδρομης η -1
+ */
+int topic_subscribe(SharedMemoryData* memory, int topic_id) {
+    lock_memory(memory);
+    
+    TopicInfo* topic = get_topic_by_id(memory, topic_id);
+    if (topic == NULL) {
+        unlock_memory(memory);
+        fprintf(stderr, "Δεν βρεθηκε topic με ID %d!\n", topic_id);
+        return -1;
+    }
+    
+    int handle = -1;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (!memory->subscribers[i].in_use) {
+            handle = i;
+            break;
+        }
+    }
+    
+    if (handle == -1) {
+        unlock_memory(memory);
+        fprintf(stderr, "Δεν υπαρχουν διαθεσιμες θεσεις συνδρομητων!\n");
+        return -1;
+    }
+    
+    Subscriber* sub = &memory->subscribers[handle];
+    sub->in_use = 1;
+    sub->topic_slot = (int) (topic - memory->all_topics);
+    sub->topic_id = topic_id;
+    sub->process_id = getpid();
+    sub->cursor = topic->head;
+    topic->subscriber_count++;
+    
+    unlock_memory(memory);
+    
+    return handle;
+}
+
+/*
+ * Ακυρωση συνδρομης
+ */
+void topic_unsubscribe(SharedMemoryData* memory, int subscription) {
+    if (subscription < 0 || subscription >= MAX_SUBSCRIBERS) {
+        return;
+    }
+    
+    lock_memory(memory);
+    
+    Subscriber* sub = &memory->subscribers[subscription];
+    if (sub->in_use && sub->process_id == getpid()) {
+        sub->in_use = 0;
+        memory->all_topics[sub->topic_slot].subscriber_count--;
+    }
+    
+    unlock_memory(memory);
+}
+
+/*
+ * Γραφει τα μηνυματα στο log του topic
+ * Αν το log ειναι γεματο, το tail ξαναϋπολογιζεται μια φορα· αν καποιος
+ * συνδρομητης εχει μεινει πισω, γραφονται μονο οσα χωρανε.
+ */
+int topic_publish(SharedMemoryData* memory, int topic_id, const char* const msgs[], int count) {
+    pid_t my_pid = getpid();
+    int published = 0;
+    int recomputed = 0;
+    
+    lock_memory(memory);
+    
+    TopicInfo* topic = get_topic_by_id(memory, topic_id);
+    if (topic == NULL) {
+        unlock_memory(memory);
+        return -1;
+    }
+    
+    while (published < count) {
+        if (topic->head - topic->tail >= TOPIC_LOG_SIZE) {
+            if (recomputed) break;
+            advance_tail(memory, topic);
+            recomputed = 1;
+            continue;
+        }
+        
+        TopicEntry* entry = &topic->log[topic->head % TOPIC_LOG_SIZE];
+        entry->seq = topic->head;
+        entry->sender_pid = my_pid;
+        strncpy(entry->text, msgs[published], MSG_TEXT_SIZE - 1);
+        entry->text[MSG_TEXT_SIZE - 1] = '\0';
+        
+        topic->head++;
+        published++;
+    }
+    
+    unlock_memory(memory);
+    
+    return published;
+}
+
+/*
+ * Διαβαζει απο το cursor μου μεχρι max_count μηνυματα
+ */
+int topic_receive(SharedMemoryData* memory, int subscription, ReceivedMessage out[], int max_count) {
+    if (subscription < 0 || subscription >= MAX_SUBSCRIBERS) {
+        return -1;
+    }
+    
+    lock_memory(memory);
+    
+    // Το handle ισχυει μονο για τη διεργασια που το πηρε και οσο ζει το topic του
+    Subscriber* sub = &memory->subscribers[subscription];
+    TopicInfo* topic = sub->in_use ? get_topic_by_id(memory, sub->topic_id) : NULL;
+    if (topic == NULL || sub->process_id != getpid()) {
+        unlock_memory(memory);
+        return -1;
+    }
+    
+    int received = 0;
+    
+    while (received < max_count && sub->cursor < topic->head) {
+        const TopicEntry* entry = &topic->log[sub->cursor % TOPIC_LOG_SIZE];
+        out[received].sender_pid = entry->sender_pid;
+        out[received].seq = entry->seq;
+        memcpy(out[received].text, entry->text, MSG_TEXT_SIZE);
+        sub->cursor++;
+        received++;
+    }
+    
+    unlock_memory(memory);
+    
+    return received;
+}
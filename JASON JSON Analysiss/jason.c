@@ -1,10 +1,19 @@
 #include "neurolib.h"
+#include "jsonlib.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <ctype.h>
-#include <unistd.h> // Include this header for unlink()
-#define BUFFER_SIZE 1024
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#define JSON_CHUNK_SIZE (64 * 1024)   // files are streamed in chunks of this size
+#define DEFAULT_CONTENT_PATH "choices[0].message.content"
 
 
 // Function to check if the filename has a ".json" extension
@@ -13,158 +22,501 @@ int has_json_extension(const char *filename) {
     return (dot && strcmp(dot, ".json") == 0); // Check if it ends with ".json"
 }
 
-// we need a function that can check if the input file has the struccture of a json file    
+// Reads the whole file: mapped when possible, otherwise into a buffer.
+// With populate all pages are read in up front, for callers that visit every byte.
+// Returns 0 on success; release with unmap_file.
+static int map_file(const char *filename, int populate, char **data, size_t *len, int *mapped) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        if (populate) {
+            flags |= MAP_POPULATE;  // skips the page faults
+        }
+#else
+        (void) populate;
+#endif
+        void *p = mmap(NULL, (size_t) st.st_size, PROT_READ, flags, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            *data = p;
+            *len = (size_t) st.st_size;
+            *mapped = 1;
+            return 0;
+        }
+    }
+
+    size_t cap = JSON_CHUNK_SIZE, n = 0;
+    char *buf = malloc(cap);
+    ssize_t got;
+    while (buf && (got = read(fd, buf + n, cap - n)) > 0) {
+        n += (size_t) got;
+        if (n == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    if (!buf) {
+        return -1;
+    }
+
+    *data = buf;
+    *len = n;
+    *mapped = 0;
+    return 0;
+}
+
+static void unmap_file(char *data, size_t len, int mapped) {
+    if (mapped) {
+        munmap(data, len);
+    } else {
+        free(data);
+    }
+}
+
+// we need a function that can check if the input file has the struccture of a json file
 int is_valid_json(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    char *data;
+    size_t len;
+    int mapped;
+
+    if (map_file(filename, 1, &data, &len, &mapped) < 0) {
         perror("Could not open file");
         return 0;
     }
 
-    int braces = 0, brackets = 0;
-    char c, prev = 0;
-    int in_string = 0;
+    int valid = json_validate_buffer(data, len);
+    unmap_file(data, len, mapped);
+    return valid;
+}
 
-    while ((c = fgetc(file)) != EOF) {
-        // Handle strings
-        if (c == '"') {
-            if (prev != '\\') { // Toggle string state only if not an escaped quote
-                in_string = !in_string;
-            }
-        }
+// Runs the extractor over a document already in memory (e.g. an API response).
+// Returns the value at path_text (to be freed by the caller) or NULL.
+char *json_extract_buffer(const char *data, size_t len, const char *path_text) {
+    json_path path;
+    if (json_path_parse(&path, path_text) < 0) {
+        fprintf(stderr, "Invalid JSON path: %s\n", path_text);
+        json_path_free(&path);
+        return NULL;
+    }
 
-        // Ignore content inside strings
-        if (in_string) {
-            prev = c;
-            continue;
+    json_extractor ex;
+    json_extractor_init(&ex, &path, 1);
+
+    int status = json_extractor_feed(&ex, data, len);
+    if (status == JSON_CONTINUE) {
+        status = json_extractor_finish(&ex);
+    }
+    if (status == JSON_ERROR) {
+        fprintf(stderr, "Invalid JSON near byte %zu\n", ex.offset);
+    }
+
+    char *value = status == JSON_FOUND ? json_extractor_take(&ex) : NULL;
+
+    json_extractor_free(&ex);
+    json_path_free(&path);
+    return value;
+}
+
+// Same for a file: it is mapped, and only the pages up to the value are read
+char *json_extract_file(const char *filename, const char *path_text) {
+    char *data;
+    size_t len;
+    int mapped;
+
+    if (map_file(filename, 0, &data, &len, &mapped) < 0) {
+        perror("Error opening file");
+        return NULL;
+    }
+
+    char *value = json_extract_buffer(data, len, path_text);
+    unmap_file(data, len, mapped);
+    return value;
+}
+
+
+// ---------------------------------------------------------------------------
+// Batch mode: many files through a pool of worker threads. Every file is
+// mapped once and validated and extracted in the same pass; the results are
+// printed as JSON lines in the order of the input list.
+// ---------------------------------------------------------------------------
+
+#define BATCH_WINDOW 4096  // how far the workers may run ahead of the output
+
+typedef struct {
+    char **items;
+    size_t count;
+    size_t cap;
+} file_list;
+
+static int file_list_add(file_list *list, const char *name) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        char **grown = realloc(list->items, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
         }
+        list->items = grown;
+        list->cap = cap;
+    }
+    list->items[list->count] = strdup(name);
+    if (!list->items[list->count]) {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
 
-        // Count braces and brackets
-        if (c == '{') braces++;
-        if (c == '}') braces--;
-        if (c == '[') brackets++;
-        if (c == ']') brackets--;
+// Every .json file of a directory, sorted by name
+static int add_directory(file_list *list, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
 
-        // Ensure counts don't go negative
-        if (braces < 0 || brackets < 0) {
-            fclose(file);
-            return 0; // Mismatched braces/brackets
+    size_t first = list->count;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!has_json_extension(entry->d_name)) {
+            continue;
+        }
+        size_t size = strlen(dir) + strlen(entry->d_name) + 2;
+        char *full = malloc(size);
+        if (!full) {
+            closedir(d);
+            return -1;
         }
+        snprintf(full, size, "%s/%s", dir, entry->d_name);
+        int added = file_list_add(list, full);
+        free(full);
+        if (added < 0) {
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
 
-        prev = c;
+    qsort(list->items + first, list->count - first, sizeof(char *), compare_names);
+    return 0;
+}
+
+// One file name per line, "-" for standard input
+static int add_list_file(file_list *list, const char *listname) {
+    FILE *in = strcmp(listname, "-") == 0 ? stdin : fopen(listname, "r");
+    if (!in) {
+        return -1;
     }
 
-    fclose(file);
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+    int result = 0;
+    while (result == 0 && (n = getline(&line, &size, in)) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            result = file_list_add(list, line);
+        }
+    }
 
-    // Valid JSON if all braces and brackets are matched and closed
-    return braces == 0 && brackets == 0 && !in_string;
+    free(line);
+    if (in != stdin) {
+        fclose(in);
+    }
+    return result;
 }
 
-// Function to trim leading spaces from a string
-char *trim_leading_spaces(char *str) {
-    while (isspace(*str)) {
-        str++;
+// A directory, @listfile or glob pattern (sorted by glob itself)
+static int add_batch_target(file_list *list, const char *target) {
+    struct stat st;
+    if (target[0] == '@') {
+        return add_list_file(list, target + 1);
+    }
+    if (stat(target, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return add_directory(list, target);
+    }
+
+    glob_t matches;
+    if (glob(target, 0, NULL, &matches) != 0) {
+        return -1;
     }
-    return str;
+    int result = 0;
+    for (size_t i = 0; i < matches.gl_pathc && result == 0; i++) {
+        result = file_list_add(list, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return result;
 }
 
-// Function to replace escape sequences like \n with actual characters
-void process_escape_sequences(char *str) {
-    char *src = str, *dest = str;
-    while (*src) {
-        if (*src == '\\' && *(src + 1) == 'n') {
-            *dest++ = '\n'; // Replace the escape sequence \n with an actual newline character
-            src += 2;      // Skip the escape sequence
-        } else {
-            if (*src == '\n') {
-                // Replace unwanted newlines (not part of the escape sequence) with a space
-                *dest++ = ' ';
+// Writes s as a JSON string
+static void write_json_string(FILE *out, const char *s, size_t len) {
+    fputc('"', out);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) s[i];
+        switch (c) {
+        case '"':  fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\n': fputs("\\n", out); break;
+        case '\r': fputs("\\r", out); break;
+        case '\t': fputs("\\t", out); break;
+        default:
+            if (c < 0x20) {
+                fprintf(out, "\\u%04x", c);
             } else {
-                *dest++ = *src; // Otherwise, copy the character as-is
+                fputc(c, out);
             }
-            src++;
         }
     }
-    *dest = '\0'; // Null-terminate the processed string
+    fputc('"', out);
 }
 
-// Function to find "choices[0].message.content"
-char *find_content_in_json(const char *filename){
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
+// The output line of one file (without the newline). *failed is set when
+// the file could not be read or is not valid JSON.
+static char *batch_process_file(const char *filename, const json_path *path, int *failed) {
+    char *line = NULL;
+    size_t line_len = 0;
+    *failed = 1;
+    FILE *out = open_memstream(&line, &line_len);
+    if (!out) {
         return NULL;
     }
 
-    char buffer[BUFFER_SIZE];
-    char content[BUFFER_SIZE * 10] = ""; // To hold multi-line content
-    int in_content = 0;                 // Flag to track if inside the "content" key
-
-    // Read the file line by line
-    while (fgets(buffer, BUFFER_SIZE, file)) {
-        
-        trim_leading_spaces(content);
-        if (in_content) {
-            // If already in "content", collect lines until the closing quote
-            char *end_quote = strchr(buffer, '\"');
-            if (end_quote) {
-                *end_quote = '\0'; // End the string at the closing quote
-                strcat(content, trim_leading_spaces(buffer));
-                break; // Exit when the value is fully extracted
-            } else {
-                strcat(content, trim_leading_spaces(buffer)); // Append trimmed line
-            }
+    fputs("{\"file\":", out);
+    write_json_string(out, filename, strlen(filename));
+
+    char *data;
+    size_t len;
+    int mapped;
+    if (map_file(filename, 1, &data, &len, &mapped) < 0) {
+        fprintf(out, ",\"error\":\"%s\"}", strerror(errno));
+        fclose(out);
+        return line;
+    }
+
+    // no early stop: running to the end is what validates the whole file
+    json_extractor ex;
+    json_extractor_init(&ex, path, 0);
+    int status = json_extractor_feed(&ex, data, len);
+    if (status != JSON_ERROR) {
+        status = json_extractor_finish(&ex);
+    }
+
+    *failed = status == JSON_ERROR;
+    if (status == JSON_ERROR) {
+        fprintf(out, ",\"error\":\"invalid JSON near byte %zu\"}", ex.offset);
+    } else if (status != JSON_FOUND) {
+        fputs(",\"value\":null}", out);
+    } else {
+        // strings are re-escaped, numbers and literals are copied as they were
+        fputs(",\"value\":", out);
+        if (ex.value_is_string) {
+            write_json_string(out, ex.value ? ex.value : "", ex.value_len);
         } else {
-            // Look for the "content" key
-            char *key = strstr(buffer, "\"content\"");
-            if (key) {
-                // Find the colon after "content"
-                char *colon = strchr(key, ':');
-                if (colon) {
-                    char *value_start = colon + 1;
-                    // Skip whitespace and the opening quote
-                    while (*value_start == ' ' || *value_start == '\"') {
-                        value_start++;
-                    }
+            fwrite(ex.value, 1, ex.value_len, out);
+        }
+        fputc('}', out);
+    }
 
-                    // Check if the value ends on the same line
-                    char *end_quote = strchr(value_start, '\"');
-                    if (end_quote) {
-                        *end_quote = '\0'; // Null-terminate the string
-                        strcpy(content, trim_leading_spaces(value_start));
-                        fclose(file);
-                        process_escape_sequences(content); // Process escape sequences
-                        return strdup(content);            // Return dynamically allocated string
-                    } else {
-                        // Otherwise, start collecting multi-line content
-                        strcpy(content, trim_leading_spaces(value_start));
-                        in_content = 1; // Set the flag to continue reading
-                    }
-                }
-            }
+    json_extractor_free(&ex);
+    unmap_file(data, len, mapped);
+    fclose(out);
+    return line;
+}
+
+typedef struct {
+    const file_list *files;
+    const json_path *path;
+    size_t next_file;     // next file for a worker
+    size_t printed;       // lines already written
+    char **lines;         // finished lines, NULL until their file is done
+    unsigned char *failed;  // per file: unreadable or invalid
+    pthread_mutex_t lock;
+    pthread_cond_t line_ready;
+    pthread_cond_t window_open;
+} batch_job;
+
+// stands in for a line that could not be allocated, never freed
+static char batch_oom_line[] = "{\"error\":\"out of memory\"}";
+
+static void *batch_worker(void *arg) {
+    batch_job *job = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->next_file++;
+        while (i < job->files->count && i >= job->printed + BATCH_WINDOW) {
+            pthread_cond_wait(&job->window_open, &job->lock);
         }
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= job->files->count) {
+            return NULL;
+        }
+
+        int failed;
+        char *line = batch_process_file(job->files->items[i], job->path, &failed);
+
+        pthread_mutex_lock(&job->lock);
+        job->failed[i] = (unsigned char) failed;
+        job->lines[i] = line ? line : batch_oom_line;
+        pthread_cond_broadcast(&job->line_ready);
+        pthread_mutex_unlock(&job->lock);
     }
+}
 
-    fclose(file);
+// Runs the whole batch, returns 0 if every file was valid
+int run_batch(const file_list *files, const char *path_text, int threads) {
+    json_path path;
+    if (json_path_parse(&path, path_text) < 0) {
+        fprintf(stderr, "Invalid JSON path: %s\n", path_text);
+        json_path_free(&path);
+        return 1;
+    }
 
-    // Process escape sequences in the content
-    process_escape_sequences(content);
+    batch_job job;
+    job.files = files;
+    job.path = &path;
+    job.next_file = 0;
+    job.printed = 0;
+    job.lines = calloc(files->count ? files->count : 1, sizeof(char *));
+    job.failed = calloc(files->count ? files->count : 1, 1);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.line_ready, NULL);
+    pthread_cond_init(&job.window_open, NULL);
+
+    pthread_t *workers = malloc((size_t) threads * sizeof(pthread_t));
+    int started = 0;
+    while (job.lines && job.failed && workers && started < threads &&
+           pthread_create(&workers[started], NULL, batch_worker, &job) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "Could not start the worker threads\n");
+        free(workers);
+        free(job.lines);
+        free(job.failed);
+        json_path_free(&path);
+        return 1;
+    }
+
+    // print in input order as soon as the next line is ready
+    int failures = 0;
+    for (size_t i = 0; i < files->count; i++) {
+        pthread_mutex_lock(&job.lock);
+        while (job.lines[i] == NULL) {
+            pthread_cond_wait(&job.line_ready, &job.lock);
+        }
+        char *line = job.lines[i];
+        job.lines[i] = NULL;
+        job.printed = i + 1;
+        pthread_cond_broadcast(&job.window_open);
+        pthread_mutex_unlock(&job.lock);
+
+        failures += job.failed[i];
+        fputs(line, stdout);
+        fputc('\n', stdout);
+        if (line != batch_oom_line) {
+            free(line);
+        }
+    }
+
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
 
-    // Return the normalized content if found, else NULL
-    return (strlen(content) > 0) ? strdup(content) : NULL;
+    pthread_cond_destroy(&job.window_open);
+    pthread_cond_destroy(&job.line_ready);
+    pthread_mutex_destroy(&job.lock);
+    free(workers);
+    free(job.lines);
+    free(job.failed);
+    json_path_free(&path);
+    return failures ? 1 : 0;
 }
 
+// jason --batch [--path json.path] <dir | 'glob' | @listfile>...
+static int batch_main(int argc, char **argv) {
+    const char *path = DEFAULT_CONTENT_PATH;
+    file_list files = {NULL, 0, 0};
+    int first = 2;
+
+    if (argc > 3 && strcmp(argv[2], "--path") == 0) {
+        path = argv[3];
+        first = 4;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "Usage:./jason --batch [--path json.path] <dir | 'glob' | @listfile>...\n");
+        return 1;
+    }
+
+    for (int i = first; i < argc; i++) {
+        if (add_batch_target(&files, argv[i]) < 0) {
+            fprintf(stderr, "No JSON files found for %s\n", argv[i]);
+        }
+    }
+
+    if (files.count == 0) {
+        return 1;
+    }
+
+    // JASON_THREADS overrides the number of online CPUs
+    const char *env = getenv("JASON_THREADS");
+    long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    int result = run_batch(&files, path, (int) threads);
+
+    for (size_t i = 0; i < files.count; i++) {
+        free(files.items[i]);
+    }
+    free(files.items);
+    return result;
+}
+
+// Bot mode: prints a piece of the answer the moment it arrives
+static void print_token(const char *token, size_t len, void *ctx) {
+    (void) ctx;
+    fwrite(token, 1, len, stdout);
+    fflush(stdout);
+}
 
 int main(int argc, char **argv){
     neurosym_init();
 
-    if(argc < 2 || argc > 3){
+    if(argc >= 2 && strcmp(argv[1], "--batch") == 0){
+        return batch_main(argc, argv);
+    }
+
+    if(argc < 2 || argc > 4){
         fprintf(stderr, "Usage:./jason <API_KEY> [filename]\n");
         return 1;
     }
 
     if(argc == 2){
         if(strcmp(argv[1], "--bot") == 0){
+            // The whole chat goes with every question, so the bot remembers earlier turns
+            conversation *chat = conversation_new();
+            if (chat == NULL) {
+                return 1;
+            }
             while(1){
                 printf("> What would you like to know? ");
                 char prompt[1024];
@@ -172,42 +524,22 @@ int main(int argc, char **argv){
                     // remove the \n character that fgets adds at the end of the input
                     prompt[strcspn(prompt, "\n")] = '\0';
 
-                    // Get the response from the API (response function already implemented)
-                    char *api_response = response(prompt);
+                    // Stream the answer, printing each piece as soon as it arrives
+                    conversation_add(chat, "user", prompt);
+                    char *response_message = conversation_stream(chat, print_token, NULL);
 
-                    if (api_response == NULL) {
+                    if (response_message == NULL) {
                     printf("Error: No response received from the API.\n");
+                    conversation_drop_last(chat);  // so the next question isn't sent after an unanswered one
                     continue;
                     }
 
-                    // Save the response to a temporary file
-                    const char *temp_filename = "temp_response.json";
-                    FILE *temp_file = fopen(temp_filename, "w");
-                    if (temp_file == NULL) {
-                        perror("Error creating temp file");
-                        free(api_response);
-                        continue;
-                    }
-
-                    fprintf(temp_file, "%s", api_response);
-                    fclose(temp_file);
-
-                    // Extract content from the JSON file
-                    char *response_message = find_content_in_json(temp_filename);
-
-                    if (response_message != NULL) {
-                        // Print the response from the function
-                        printf("%s\n", response_message);
-                        free(response_message);  // Don't forget to free memory!
-                    } else {
-                        printf("Failed to find content in the JSON response.\n");
-                    }
-
-                    // Clean up the temporary file
-                    unlink(temp_filename);  // Remove the temporary file
-                    free(api_response);  // Free the memory allocated by the response function
+                    printf("\n");
+                    conversation_add(chat, "assistant", response_message);
+                    free(response_message);  // Don't forget to free memory!
                 } else {
                     printf("Terminating\n");
+                    conversation_free(chat);
                     return 1;
                 }
             }
@@ -217,8 +549,10 @@ int main(int argc, char **argv){
             return 1;
         }
 
-    }else if(argc == 3){
+    }else{
         if(strcmp(argv[1], "--extract") == 0){ 
+            // an optional path picks another value than choices[0].message.content
+            const char *path = argc == 4 ? argv[3] : DEFAULT_CONTENT_PATH;
             if(has_json_extension(argv[2])){ // we check if the file the json extension
                 if(!is_valid_json(argv[2])){ //we chevck if the arguement is a valid json file
                     fprintf(stderr, "Not an accepted JSON!\n");
@@ -226,9 +560,13 @@ int main(int argc, char **argv){
                 }
              //we continue our program since we have checked our arguement
                 // response(argv[2])
-                char *content= find_content_in_json(argv[2]);
+                char *content= json_extract_file(argv[2], path);
+                if(content == NULL){
+                    fprintf(stderr, "No value at %s\n", path);
+                    return 1;
+                }
                 printf("%s\n", content);
-               
+                free(content);
 
             } else {
                 fprintf(stderr, "The file does not have a '.json' extension\n");
@@ -0,0 +1,930 @@
+// JSON path extraction and validation, shared by jason and neurolib
+#include "jsonlib.h"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdint.h>
+
+// Parses "a.b[2].c" into steps, returns 0 on success and -1 on a malformed path
+int json_path_parse(json_path *path, const char *text) {
+    path->count = 0;
+    path->storage = strdup(text);
+    if (!path->storage) {
+        return -1;
+    }
+
+    char *p = path->storage;
+    while (*p) {
+        if (path->count == JSON_MAX_DEPTH) {
+            return -1;
+        }
+        path_step *step = &path->steps[path->count++];
+
+        if (*p == '[') {
+            char *close;
+            step->key = NULL;
+            step->key_len = 0;
+            step->index = strtol(p + 1, &close, 10);
+            if (close == p + 1 || *close != ']' || step->index < 0) {
+                return -1;
+            }
+            p = close + 1;
+        } else {
+            step->key = p;
+            while (*p && *p != '.' && *p != '[') {
+                p++;
+            }
+            step->key_len = (size_t)(p - step->key);
+            if (step->key_len == 0) {
+                return -1;
+            }
+        }
+
+        // a '.' separates steps, a '[' starts the next one directly
+        if (*p == '.') {
+            p++;
+            if (*p == '\0') {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void json_path_free(json_path *path) {
+    free(path->storage);
+    path->storage = NULL;
+}
+
+// States of the streaming tokenizer
+enum {
+    JS_VALUE,          // expecting a value (root or after ':')
+    JS_OBJECT_START,   // after '{': a key or '}'
+    JS_OBJECT_KEY,     // after ',' in an object: a key
+    JS_COLON,          // after a key
+    JS_ARRAY_START,    // after '[': a value or ']'
+    JS_ARRAY_VALUE,    // after ',' in an array: a value
+    JS_AFTER_VALUE,    // after a value inside a container: ',' or the closing bracket
+    JS_STRING,
+    JS_ESCAPE,         // after a backslash
+    JS_UNICODE,        // inside the four hex digits of \uXXXX
+    JS_NUMBER,
+    JS_LITERAL,        // true, false or null
+    JS_DONE,           // root value finished, only whitespace may follow
+    JS_ERROR
+};
+
+// Sub-states of a number, following the JSON grammar
+enum {
+    NUM_SIGN,          // after '-': a digit must follow
+    NUM_ZERO,          // a leading 0: no more integer digits
+    NUM_INT,
+    NUM_DOT,           // after '.': a digit must follow
+    NUM_FRACTION,
+    NUM_E,             // after 'e': a sign or a digit
+    NUM_EXP_SIGN,      // after the exponent sign: a digit must follow
+    NUM_EXPONENT
+};
+
+void json_extractor_init(json_extractor *ex, const json_path *path, int stop_when_found) {
+    memset(ex, 0, sizeof(*ex));
+    ex->path = path;
+    ex->stop_when_found = stop_when_found;
+    ex->state = JS_VALUE;
+}
+
+void json_extractor_free(json_extractor *ex) {
+    free(ex->value);
+    ex->value = NULL;
+}
+
+// Takes the extracted value (NUL terminated), or NULL if none was found
+char *json_extractor_take(json_extractor *ex) {
+    if (!ex->found) {
+        return NULL;
+    }
+    char *value = ex->value ? ex->value : strdup("");
+    ex->value = NULL;
+    return value;
+}
+
+static int append_value(json_extractor *ex, const char *data, size_t len) {
+    if (ex->value_len + len + 1 > ex->value_cap) {
+        size_t cap = ex->value_cap ? ex->value_cap : 256;
+        while (ex->value_len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *grown = realloc(ex->value, cap);
+        if (!grown) {
+            return -1;
+        }
+        ex->value = grown;
+        ex->value_cap = cap;
+    }
+    memcpy(ex->value + ex->value_len, data, len);
+    ex->value_len += len;
+    ex->value[ex->value_len] = '\0';
+    return 0;
+}
+
+// Decoded string bytes go either to the key comparison or to the value
+static int string_bytes(json_extractor *ex, const char *data, size_t len) {
+    if (ex->string_is_key) {
+        if (ex->key_check && ex->key_match) {
+            const path_step *step = &ex->path->steps[ex->depth - 1];
+            ex->key_match = ex->key_pos + len <= step->key_len &&
+                            memcmp(step->key + ex->key_pos, data, len) == 0;
+            ex->key_pos += len;
+        }
+        return 0;
+    }
+    return ex->capturing ? append_value(ex, data, len) : 0;
+}
+
+static int emit_code_point(json_extractor *ex, unsigned int cp) {
+    char utf8[4];
+    size_t n;
+
+    if (cp < 0x80) {
+        utf8[0] = (char) cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        utf8[0] = (char)(0xC0 | (cp >> 6));
+        utf8[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        utf8[0] = (char)(0xE0 | (cp >> 12));
+        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (cp >> 18));
+        utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    return string_bytes(ex, utf8, n);
+}
+
+// A high surrogate not followed by a low one becomes U+FFFD
+static int flush_surrogate(json_extractor *ex) {
+    if (!ex->high_surrogate) {
+        return 0;
+    }
+    ex->high_surrogate = 0;
+    return emit_code_point(ex, 0xFFFD);
+}
+
+static int unicode_escape(json_extractor *ex, unsigned int cp) {
+    if (ex->high_surrogate && cp >= 0xDC00 && cp <= 0xDFFF) {
+        cp = 0x10000 + ((ex->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+        ex->high_surrogate = 0;
+        return emit_code_point(ex, cp);
+    }
+    if (flush_surrogate(ex) < 0) {
+        return -1;
+    }
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        ex->high_surrogate = cp;
+        return 0;
+    }
+    if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        cp = 0xFFFD;
+    }
+    return emit_code_point(ex, cp);
+}
+
+// Does the path match every open level below 'level'?
+static int prefix_matches(const json_extractor *ex, int level) {
+    return level == 0 || ex->level_match[level - 1];
+}
+
+// Is the value starting now the one at the path? Only the first match
+// counts, so a duplicate key gives the same value whether or not the
+// extractor stops there
+static int at_target(const json_extractor *ex) {
+    return !ex->found && ex->path->count == ex->depth && prefix_matches(ex, ex->depth);
+}
+
+static void enter_array_element(json_extractor *ex) {
+    int level = ex->depth - 1;
+    const path_step *step = &ex->path->steps[level];
+    ex->level_match[level] = level < ex->path->count && prefix_matches(ex, level) &&
+                             step->key == NULL && step->index == ex->index[level];
+}
+
+// Called when any value is complete
+static int end_value(json_extractor *ex) {
+    if (ex->capturing) {
+        ex->capturing = 0;
+        ex->found = 1;
+    }
+    ex->state = ex->depth == 0 ? JS_DONE : JS_AFTER_VALUE;
+    return (ex->found && ex->stop_when_found) ? JSON_FOUND : JSON_CONTINUE;
+}
+
+static int push_container(json_extractor *ex, char type) {
+    if (ex->depth == JSON_MAX_DEPTH) {
+        return -1;
+    }
+    ex->stack[ex->depth] = type;
+    ex->index[ex->depth] = 0;
+    ex->level_match[ex->depth] = 0;
+    ex->depth++;
+    ex->state = type == '{' ? JS_OBJECT_START : JS_ARRAY_START;
+    return 0;
+}
+
+static void start_key(json_extractor *ex) {
+    int level = ex->depth - 1;
+    ex->string_is_key = 1;
+    ex->key_check = level < ex->path->count && prefix_matches(ex, level) &&
+                    ex->path->steps[level].key != NULL;
+    ex->key_match = 1;
+    ex->key_pos = 0;
+    ex->state = JS_STRING;
+}
+
+static int begin_value(json_extractor *ex, unsigned char c) {
+    // only scalars are extracted, containers at the path are walked through
+    int target = at_target(ex);
+
+    switch (c) {
+    case '{':
+    case '[':
+        return push_container(ex, (char) c);
+    case '"':
+        ex->string_is_key = 0;
+        ex->capturing = target;
+        if (target) {
+            ex->value_is_string = 1;  // later strings must not reset it
+        }
+        ex->state = JS_STRING;
+        return 0;
+    case 't':
+        ex->literal = "true";
+        break;
+    case 'f':
+        ex->literal = "false";
+        break;
+    case 'n':
+        ex->literal = "null";
+        break;
+    default:
+        if (c != '-' && !isdigit(c)) {
+            return -1;
+        }
+        ex->capturing = target;
+        ex->number_state = c == '-' ? NUM_SIGN : (c == '0' ? NUM_ZERO : NUM_INT);
+        ex->state = JS_NUMBER;
+        return ex->capturing ? append_value(ex, (const char *) &c, 1) : 0;
+    }
+
+    ex->capturing = target;
+    ex->literal_pos = 1;
+    ex->state = JS_LITERAL;
+    return ex->capturing ? append_value(ex, (const char *) &c, 1) : 0;
+}
+
+// Advances the number grammar by one character, 0 if it does not belong to the number
+static int number_step(int *state, unsigned char c) {
+    int digit = isdigit(c);
+
+    switch (*state) {
+    case NUM_SIGN:
+        if (!digit) return 0;
+        *state = c == '0' ? NUM_ZERO : NUM_INT;
+        return 1;
+    case NUM_ZERO:
+    case NUM_INT:
+        if (digit && *state == NUM_INT) return 1;
+        if (c == '.') { *state = NUM_DOT; return 1; }
+        if (c == 'e' || c == 'E') { *state = NUM_E; return 1; }
+        return 0;
+    case NUM_DOT:
+    case NUM_FRACTION:
+        if (digit) { *state = NUM_FRACTION; return 1; }
+        if (*state == NUM_FRACTION && (c == 'e' || c == 'E')) {
+            *state = NUM_E;
+            return 1;
+        }
+        return 0;
+    case NUM_E:
+        if (c == '+' || c == '-') { *state = NUM_EXP_SIGN; return 1; }
+        if (digit) { *state = NUM_EXPONENT; return 1; }
+        return 0;
+    default:
+        if (digit) { *state = NUM_EXPONENT; return 1; }
+        return 0;
+    }
+}
+
+static int number_complete(int state) {
+    return state == NUM_ZERO || state == NUM_INT ||
+           state == NUM_FRACTION || state == NUM_EXPONENT;
+}
+
+static int is_json_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Feeds the next chunk of the document.
+// Returns JSON_FOUND once the value is complete (with stop_when_found),
+// JSON_ERROR on invalid JSON and JSON_CONTINUE otherwise.
+int json_extractor_feed(json_extractor *ex, const char *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    const unsigned char *end = p + len;
+    int result = JSON_CONTINUE;
+
+    if (ex->state == JS_ERROR) {
+        return JSON_ERROR;
+    }
+
+    while (p < end && result == JSON_CONTINUE) {
+        unsigned char c = *p;
+
+        if (ex->state == JS_STRING) {
+            // copy plain runs in one go instead of byte by byte
+            const unsigned char *run = p;
+            while (p < end && *p != '"' && *p != '\\' && *p >= 0x20) {
+                p++;
+            }
+            if (p > run && (flush_surrogate(ex) < 0 ||
+                            string_bytes(ex, (const char *) run, (size_t)(p - run)) < 0)) {
+                goto fail;
+            }
+            if (p == end) {
+                break;
+            }
+
+            c = *p++;
+            if (c == '\\') {
+                ex->state = JS_ESCAPE;
+            } else if (c != '"') {
+                goto fail;  // raw control character
+            } else if (flush_surrogate(ex) < 0) {
+                goto fail;
+            } else if (ex->string_is_key) {
+                const path_step *step = &ex->path->steps[ex->depth - 1];
+                ex->level_match[ex->depth - 1] = ex->key_check && ex->key_match &&
+                                                 ex->key_pos == step->key_len;
+                ex->state = JS_COLON;
+            } else {
+                result = end_value(ex);
+            }
+            continue;
+        }
+
+        // a number ends at the first character that is not part of it,
+        // which is then processed again in the new state
+        if (ex->state == JS_NUMBER) {
+            if (number_step(&ex->number_state, c)) {
+                if (ex->capturing && append_value(ex, (const char *) &c, 1) < 0) {
+                    goto fail;
+                }
+                p++;
+                continue;
+            }
+            if (!number_complete(ex->number_state)) {
+                goto fail;
+            }
+            result = end_value(ex);
+            continue;
+        }
+
+        p++;
+
+        switch (ex->state) {
+        case JS_ESCAPE: {
+            const char *escapes = "\"\\/bfnrt";
+            const char *decoded = "\"\\/\b\f\n\r\t";
+            const char *hit = c ? strchr(escapes, c) : NULL;
+
+            if (c == 'u') {
+                ex->code_point = 0;
+                ex->hex_digits = 0;
+                ex->state = JS_UNICODE;
+                break;
+            }
+            if (!hit || flush_surrogate(ex) < 0 ||
+                string_bytes(ex, &decoded[hit - escapes], 1) < 0) {
+                goto fail;
+            }
+            ex->state = JS_STRING;
+            break;
+        }
+
+        case JS_UNICODE: {
+            int h = hex_value(c);
+            if (h < 0) {
+                goto fail;
+            }
+            ex->code_point = (ex->code_point << 4) | (unsigned int) h;
+            if (++ex->hex_digits == 4) {
+                if (unicode_escape(ex, ex->code_point) < 0) {
+                    goto fail;
+                }
+                ex->state = JS_STRING;
+            }
+            break;
+        }
+
+        case JS_LITERAL:
+            if ((char) c != ex->literal[ex->literal_pos]) {
+                goto fail;
+            }
+            if (ex->capturing && append_value(ex, (const char *) &c, 1) < 0) {
+                goto fail;
+            }
+            if (ex->literal[++ex->literal_pos] == '\0') {
+                result = end_value(ex);
+            }
+            break;
+
+        default:
+            if (is_json_space(c)) {
+                break;
+            }
+
+            switch (ex->state) {
+            case JS_VALUE:
+                if (begin_value(ex, c) < 0) goto fail;
+                break;
+
+            case JS_ARRAY_START:
+                if (c == ']') {
+                    ex->depth--;
+                    result = end_value(ex);
+                    break;
+                }
+                /* fall through */
+            case JS_ARRAY_VALUE:
+                enter_array_element(ex);
+                if (begin_value(ex, c) < 0) goto fail;
+                break;
+
+            case JS_OBJECT_START:
+                if (c == '}') {
+                    ex->depth--;
+                    result = end_value(ex);
+                    break;
+                }
+                /* fall through */
+            case JS_OBJECT_KEY:
+                if (c != '"') goto fail;
+                start_key(ex);
+                break;
+
+            case JS_COLON:
+                if (c != ':') goto fail;
+                ex->state = JS_VALUE;
+                break;
+
+            case JS_AFTER_VALUE: {
+                char type = ex->stack[ex->depth - 1];
+                if (c == ',') {
+                    if (type == '[') {
+                        ex->index[ex->depth - 1]++;
+                        ex->state = JS_ARRAY_VALUE;
+                    } else {
+                        ex->state = JS_OBJECT_KEY;
+                    }
+                } else if ((c == '}' && type == '{') || (c == ']' && type == '[')) {
+                    ex->depth--;
+                    result = end_value(ex);
+                } else {
+                    goto fail;
+                }
+                break;
+            }
+
+            default:
+                goto fail;  // JS_DONE: nothing but whitespace may follow
+            }
+        }
+    }
+
+    ex->offset += (size_t)(p - (const unsigned char *) data);
+    return result;
+
+fail:
+    ex->offset += (size_t)(p - (const unsigned char *) data);
+    ex->state = JS_ERROR;
+    return JSON_ERROR;
+}
+
+// Ends the document: a number at the root is only complete now.
+// Returns JSON_FOUND or JSON_CONTINUE (not found) for a valid document, JSON_ERROR otherwise.
+int json_extractor_finish(json_extractor *ex) {
+    if (ex->state == JS_NUMBER && ex->depth == 0 && number_complete(ex->number_state)) {
+        end_value(ex);
+    }
+    if (ex->state != JS_DONE) {
+        return JSON_ERROR;
+    }
+    return ex->found ? JSON_FOUND : JSON_CONTINUE;
+}
+
+// ---------------------------------------------------------------------------
+// Validation in two stages, in the style of simdjson:
+//  1. every 64-byte block is classified at once (SIMD where available) into
+//     bitmasks of quotes, backslashes, brackets and whitespace, from which
+//     the string regions and the positions of all structural characters follow
+//  2. the grammar is checked by walking only those positions
+// Stage 1 works on small windows, so memory use does not grow with the input.
+// ---------------------------------------------------------------------------
+
+#define JSON_SCAN_WINDOW 8192  // bytes classified per stage 1 round (multiple of 64)
+
+// Bitmasks of one 64-byte block, bit i describing byte i
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;        // { } [ ] : ,
+    uint64_t space;
+    uint64_t control;   // bytes below 0x20, not allowed inside strings
+} block_masks;
+
+typedef void (*classify_fn)(const unsigned char *block, block_masks *m);
+
+#if !defined(JSON_NO_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+// SSE2 (always present on x86-64): four 16-byte lanes per block
+static void classify_sse2(const unsigned char *block, block_masks *m) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i open = _mm_set1_epi8('{');    // '[' | 0x20 == '{'
+    const __m128i close = _mm_set1_epi8('}');   // ']' | 0x20 == '}'
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i bit5 = _mm_set1_epi8(0x20);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i below_space = _mm_set1_epi8(0x1F);
+
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+        __m128i folded = _mm_or_si128(v, bit5);
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, below_space), v);
+        __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, bit5), _mm_cmpeq_epi8(v, tab)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, cr)));
+        int shift = 16 * i;
+
+        m->quote |= (uint64_t)(unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << shift;
+        m->backslash |= (uint64_t)(unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << shift;
+        m->op |= (uint64_t)(unsigned) _mm_movemask_epi8(op) << shift;
+        m->space |= (uint64_t)(unsigned) _mm_movemask_epi8(space) << shift;
+        m->control |= (uint64_t)(unsigned) _mm_movemask_epi8(control) << shift;
+    }
+}
+
+// AVX2: two 32-byte lanes per block, picked at run time
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char *block, block_masks *m) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i below_space = _mm256_set1_epi8(0x1F);
+
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + 32 * i));
+        __m256i folded = _mm256_or_si256(v, bit5);
+        __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close)),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, below_space), v);
+        __m256i space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, bit5), _mm256_cmpeq_epi8(v, tab)),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, newline), _mm256_cmpeq_epi8(v, cr)));
+        int shift = 32 * i;
+
+        m->quote |= (uint64_t)(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << shift;
+        m->backslash |= (uint64_t)(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << shift;
+        m->op |= (uint64_t)(uint32_t) _mm256_movemask_epi8(op) << shift;
+        m->space |= (uint64_t)(uint32_t) _mm256_movemask_epi8(space) << shift;
+        m->control |= (uint64_t)(uint32_t) _mm256_movemask_epi8(control) << shift;
+    }
+}
+
+static classify_fn pick_classifier(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? classify_avx2 : classify_sse2;
+}
+#else
+// Portable fallback (other CPUs or -DJSON_NO_SIMD), one byte at a time
+static void classify_scalar(const unsigned char *block, block_masks *m) {
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        unsigned char c = block[i];
+
+        switch (c) {
+        case '"':  m->quote |= bit; break;
+        case '\\': m->backslash |= bit; break;
+        case '{': case '}': case '[': case ']': case ':': case ',':
+            m->op |= bit;
+            break;
+        case ' ': m->space |= bit; break;
+        case '\t': case '\n': case '\r':
+            m->space |= bit;
+            m->control |= bit;
+            break;
+        default:
+            if (c < 0x20) m->control |= bit;
+        }
+    }
+}
+
+static classify_fn pick_classifier(void) {
+    return classify_scalar;
+}
+#endif
+
+// Characters escaped by a backslash: a run of backslashes escapes the
+// next character only if its length is odd (simdjson's find_escaped)
+static uint64_t find_escaped(uint64_t backslash, uint64_t *prev_escaped) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    backslash &= ~*prev_escaped;
+    uint64_t follows_escape = backslash << 1 | *prev_escaped;
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t even_sequences;
+    *prev_escaped = __builtin_add_overflow(odd_starts, backslash, &even_sequences);
+    return (even_bits ^ (even_sequences << 1)) & follows_escape;
+}
+
+// Bit i becomes the xor of bits 0..i: 1 from an opening quote up to the closing one
+static uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+typedef struct {
+    const unsigned char *buf;
+    size_t len;
+    classify_fn classify;
+    size_t block_pos;          // next byte for stage 1
+    uint64_t prev_escaped;     // state carried from block to block
+    uint64_t prev_in_string;
+    uint64_t prev_scalar;
+    int error;                 // a control character inside a string
+    size_t indices[JSON_SCAN_WINDOW];
+    size_t count;
+    size_t next;
+} json_scanner;
+
+static void scanner_init(json_scanner *sc, const char *data, size_t len) {
+    memset(sc, 0, offsetof(json_scanner, indices));
+    sc->buf = (const unsigned char *) data;
+    sc->len = len;
+    sc->classify = pick_classifier();
+    sc->count = sc->next = 0;
+}
+
+// Is the character at pos, which follows a backslash, a valid escape?
+static int valid_escape(const json_scanner *sc, size_t pos) {
+    const unsigned char *s = sc->buf + pos;
+
+    if (pos >= sc->len) {
+        return 0;  // a backslash at the very end
+    }
+    switch (*s) {
+    case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+        return 1;
+    case 'u':
+        return sc->len - pos > 4 && hex_value(s[1]) >= 0 && hex_value(s[2]) >= 0 &&
+               hex_value(s[3]) >= 0 && hex_value(s[4]) >= 0;
+    default:
+        return 0;
+    }
+}
+
+// Stage 1 over the next window: collects the positions of brackets, colons,
+// commas, both quotes of every string and the first byte of every number or literal.
+// Control characters and escapes inside strings are checked here as well.
+static void scan_window(json_scanner *sc) {
+    size_t end = sc->block_pos + JSON_SCAN_WINDOW;
+    if (end > sc->len) {
+        end = sc->len;
+    }
+    sc->count = sc->next = 0;
+
+    while (sc->block_pos < end) {
+        const unsigned char *block = sc->buf + sc->block_pos;
+        unsigned char padded[64];
+        block_masks m;
+
+        // the last block is padded with spaces
+        if (sc->len - sc->block_pos < 64) {
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, block, sc->len - sc->block_pos);
+            block = padded;
+        }
+        sc->classify(block, &m);
+
+        uint64_t escaped = find_escaped(m.backslash, &sc->prev_escaped);
+        uint64_t quote = m.quote & ~escaped;
+        uint64_t in_string = prefix_xor(quote) ^ sc->prev_in_string;
+        sc->prev_in_string = (uint64_t)((int64_t) in_string >> 63);
+
+        if (m.control & in_string) {
+            sc->error = 1;
+        }
+
+        // escapes are rare, so they are checked here one by one
+        while (escaped) {
+            if (!valid_escape(sc, sc->block_pos + (size_t) __builtin_ctzll(escaped))) {
+                sc->error = 1;
+            }
+            escaped &= escaped - 1;
+        }
+
+        uint64_t scalar = ~(m.op | m.space | m.quote | in_string);
+        uint64_t scalar_start = scalar & ~(scalar << 1 | sc->prev_scalar);
+        sc->prev_scalar = scalar >> 63;
+
+        uint64_t structural = (m.op & ~in_string) | quote | scalar_start;
+        while (structural) {
+            sc->indices[sc->count++] = sc->block_pos + (size_t) __builtin_ctzll(structural);
+            structural &= structural - 1;
+        }
+        sc->block_pos += 64;
+    }
+}
+
+// Next structural position, 0 when the input is exhausted
+static int next_structural(json_scanner *sc, size_t *pos) {
+    while (sc->next == sc->count) {
+        if (sc->block_pos >= sc->len || sc->error) {
+            return 0;
+        }
+        scan_window(sc);
+    }
+    *pos = sc->indices[sc->next++];
+    return 1;
+}
+
+// Can this byte follow a number or literal?
+static int is_delimiter(unsigned char c) {
+    switch (c) {
+    case ' ': case '\t': case '\n': case '\r':
+    case '{': case '}': case '[': case ']': case ':': case ',': case '"':
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Checks the number or literal starting at pos
+static int valid_scalar(const unsigned char *buf, size_t len, size_t pos) {
+    const unsigned char *s = buf + pos;
+    size_t left = len - pos;
+    size_t n;
+
+    if (s[0] == 't' || s[0] == 'n' || s[0] == 'f') {
+        const char *literal = s[0] == 't' ? "true" : (s[0] == 'n' ? "null" : "false");
+        n = strlen(literal);
+        if (left < n || memcmp(s, literal, n) != 0) {
+            return 0;
+        }
+    } else {
+        if (s[0] != '-' && !isdigit(s[0])) {
+            return 0;
+        }
+        int state = s[0] == '-' ? NUM_SIGN : (s[0] == '0' ? NUM_ZERO : NUM_INT);
+        for (n = 1; n < left && number_step(&state, s[n]); n++) {
+        }
+        if (!number_complete(state)) {
+            return 0;
+        }
+    }
+    return n == left || is_delimiter(s[n]);
+}
+
+// Grammar states of stage 2
+enum {
+    EXPECT_VALUE,
+    EXPECT_KEY_OR_END,     // after '{'
+    EXPECT_KEY,            // after ',' in an object
+    EXPECT_COLON,
+    EXPECT_VALUE_OR_END,   // after '['
+    EXPECT_COMMA_OR_END,
+    EXPECT_NOTHING         // the root value is complete
+};
+
+// Validates a whole document in memory, returns 1 if it is valid JSON
+int json_validate_buffer(const char *data, size_t len) {
+    json_scanner *sc = malloc(sizeof(*sc));
+    if (!sc) {
+        return 0;
+    }
+    scanner_init(sc, data, len);
+
+    char stack[JSON_MAX_DEPTH];
+    int depth = 0;
+    int state = EXPECT_VALUE;
+    int valid = 1;
+    size_t pos;
+
+    while (valid && next_structural(sc, &pos)) {
+        unsigned char c = sc->buf[pos];
+        int is_value = 0;
+
+        switch (state) {
+        case EXPECT_VALUE_OR_END:
+            if (c == ']') {
+                depth--;
+                state = depth ? EXPECT_COMMA_OR_END : EXPECT_NOTHING;
+                break;
+            }
+            /* fall through */
+        case EXPECT_VALUE:
+            is_value = 1;
+            break;
+
+        case EXPECT_KEY_OR_END:
+            if (c == '}') {
+                depth--;
+                state = depth ? EXPECT_COMMA_OR_END : EXPECT_NOTHING;
+                break;
+            }
+            /* fall through */
+        case EXPECT_KEY: {
+            size_t close;
+            valid = c == '"' && next_structural(sc, &close);
+            state = EXPECT_COLON;
+            break;
+        }
+
+        case EXPECT_COLON:
+            valid = c == ':';
+            state = EXPECT_VALUE;
+            break;
+
+        case EXPECT_COMMA_OR_END:
+            if (c == ',') {
+                state = stack[depth - 1] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+            } else if ((c == '}' && stack[depth - 1] == '{') || (c == ']' && stack[depth - 1] == '[')) {
+                depth--;
+                state = depth ? EXPECT_COMMA_OR_END : EXPECT_NOTHING;
+            } else {
+                valid = 0;
+            }
+            break;
+
+        default:
+            valid = 0;
+        }
+
+        if (!is_value || !valid) {
+            continue;
+        }
+
+        if (c == '{' || c == '[') {
+            if (depth == JSON_MAX_DEPTH) {
+                valid = 0;
+                continue;
+            }
+            stack[depth++] = (char) c;
+            state = c == '{' ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+            continue;
+        }
+
+        if (c == '"') {
+            size_t close;
+            valid = next_structural(sc, &close);  // the closing quote
+        } else {
+            valid = valid_scalar(sc->buf, sc->len, pos);
+        }
+        state = depth ? EXPECT_COMMA_OR_END : EXPECT_NOTHING;
+    }
+
+    // an unterminated string leaves the scanner inside a string
+    valid = valid && !sc->error && !sc->prev_in_string && state == EXPECT_NOTHING;
+    free(sc);
+    return valid;
+}
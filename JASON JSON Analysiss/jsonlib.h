@@ -0,0 +1,90 @@
+#ifndef JSONLIB_H
+#define JSONLIB_H
+
+#include <stddef.h>
+
+#define JSON_MAX_DEPTH 256            // deepest nesting the tokenizer accepts
+
+// Parsed form of a path like "choices[0].message.content"
+// every step is either an object key or an array index
+typedef struct {
+    const char *key;   // NULL when the step is an array index
+    size_t key_len;
+    long index;
+} path_step;
+
+typedef struct {
+    path_step steps[JSON_MAX_DEPTH];
+    int count;
+    char *storage;     // private copy of the path text, keys point into it
+} json_path;
+
+#define JSON_ERROR -1
+#define JSON_CONTINUE 0
+#define JSON_FOUND 1
+
+// Streaming extractor: fed the document in chunks of any size, it checks the
+// grammar and keeps the value at one path. Besides that value its memory use
+// is fixed, whatever the size of the document.
+typedef struct {
+    const json_path *path;
+    int stop_when_found;   // stop as soon as the value is complete
+    int state;
+    size_t offset;         // bytes consumed, for error messages
+
+    // open containers, '{' or '[', with the current array index
+    // and whether the path matches down to this level
+    char stack[JSON_MAX_DEPTH];
+    long index[JSON_MAX_DEPTH];
+    unsigned char level_match[JSON_MAX_DEPTH];
+    int depth;
+
+    // string in progress
+    int string_is_key;
+    int key_check;         // this key is compared against the path
+    int key_match;
+    size_t key_pos;
+    unsigned int code_point;
+    int hex_digits;
+    unsigned int high_surrogate;
+
+    int number_state;
+    const char *literal;
+    int literal_pos;
+
+    // the extracted value
+    int capturing;
+    int found;
+    int value_is_string;   // otherwise a number or literal, kept as written
+    char *value;
+    size_t value_len;
+    size_t value_cap;
+} json_extractor;
+
+// Parses "a.b[2].c" into steps, returns 0 on success and -1 on a malformed path.
+// Release with json_path_free(), also after a failure.
+int json_path_parse(json_path *path, const char *text);
+void json_path_free(json_path *path);
+
+// With stop_when_found, feeding stops as soon as the value is complete
+// and the rest of the document is not checked.
+void json_extractor_init(json_extractor *ex, const json_path *path, int stop_when_found);
+void json_extractor_free(json_extractor *ex);
+
+// Feeds the next chunk of the document.
+// Returns JSON_FOUND once the value is complete (with stop_when_found),
+// JSON_ERROR on invalid JSON and JSON_CONTINUE otherwise.
+int json_extractor_feed(json_extractor *ex, const char *data, size_t len);
+
+// Ends the document. Returns JSON_FOUND or JSON_CONTINUE (not found)
+// for a valid document, JSON_ERROR otherwise.
+int json_extractor_finish(json_extractor *ex);
+
+// Takes the extracted value (NUL terminated), or NULL if none was found.
+// The caller frees it.
+char *json_extractor_take(json_extractor *ex);
+
+// Validates a whole document in memory, returns 1 if it is valid JSON
+int json_validate_buffer(const char *data, size_t len);
+
+#endif
@@ -11,16 +11,69 @@
 #include <unistd.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
 #include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "neurolib.h"
+#include "jsonlib.h"
 
 // Internal global variables, not exposed in the header
 // to prevent accidental modification by the user
 char initialized = 0;
 char * api_key = NULL;
 char * api_url = "api.openai.com";
+char * api_port = "443";
 char * model = "gpt-4o-mini";
 int max_tokens = 100;
 
+// Kept-alive TLS connections, shared by every call to response()
+#define POOL_SIZE 8
+#define READ_SIZE (16 * 1024)   // one full TLS record per SSL_read
+
+typedef struct {
+    int fd;       // -1 when the slot has no open connection
+    SSL * ssl;
+    int in_use;
+    int pooled;   // 0 for a one-off connection opened when the pool was busy
+} connection;
+
+// Receive buffer of one response
+typedef struct {
+    char * data;
+    size_t len;
+    size_t cap;
+} recv_buffer;
+
+// Growing output buffer of the JSON writer
+typedef struct {
+    char * data;
+    size_t len;
+    size_t cap;
+} json_writer;
+
+static connection pool[POOL_SIZE];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static SSL_CTX * tls_ctx = NULL;          // one context for every connection
+static SSL_SESSION * tls_session = NULL;  // last session, resumed by new connections
+static json_path delta_path;              // the text of a streamed event
+static json_path message_path;            // the text of a whole reply
+
+typedef struct sse_stream sse_stream;
+
+static void release_connection(connection * conn, int keep_alive);
+static void sse_feed(sse_stream * stream, const char * body, size_t len);
+
 // Initializes the neurosymbolic library. This function
 // must be called *exactly once* before calling any other
 // function in the library.
@@ -31,10 +84,44 @@ void neurosym_init() {
     }
     initialized = 1;
     api_key = getenv("OPENAI_API_KEY");
+    // A local stand-in server can replace the real API
+    if (getenv("NEUROLIB_API_HOST") != NULL) {
+        api_url = getenv("NEUROLIB_API_HOST");
+    }
+    if (getenv("NEUROLIB_API_PORT") != NULL) {
+        api_port = getenv("NEUROLIB_API_PORT");
+    }
     SSL_library_init();
     SSL_load_error_strings();
     OpenSSL_add_all_algorithms();
     srand(time(NULL));
+
+    // Writing to a kept-alive connection the server already closed must fail
+    // with an error (and be retried), not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    json_path_parse(&delta_path, "choices[0].delta.content");
+    json_path_parse(&message_path, "choices[0].message.content");
+
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pool[i].fd = -1;
+        pool[i].pooled = 1;
+    }
+    tls_ctx = SSL_CTX_new(TLS_client_method());
+    if (tls_ctx != NULL) {
+        SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+        SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_CLIENT);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // Servers often close without close_notify; for an unframed body that is the end
+        SSL_CTX_set_options(tls_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+    }
+
+    // Repeated prompts can be answered from a cache
+    if (getenv("NEUROLIB_CACHE_DIR") != NULL) {
+        char * ttl = getenv("NEUROLIB_CACHE_TTL");
+        response_cache_enable(getenv("NEUROLIB_CACHE_DIR"), ttl != NULL ? atoi(ttl) : 0, 0);
+    }
 }
 
 // Function to generate a fake response when the API key is not set
@@ -97,185 +184,1637 @@ char * fake_response() {
     return response;
 }
 
-// Function to create and connect a socket to the given hostname and port.
-int create_socket(const char *hostname, const char *port) {
-    int sockfd;
-    struct addrinfo hints, *res;
+// Resolves the API address once; later connections reuse it
+static int resolve_address(const char *hostname, const char *port, struct addrinfo * addr) {
+    static struct addrinfo * cached = NULL;
+    static char cached_host[256], cached_port[16];
+
+    pthread_mutex_lock(&pool_lock);
+    if (cached == NULL || strcmp(cached_host, hostname) != 0 || strcmp(cached_port, port) != 0) {
+        struct addrinfo hints, *res;
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
 
-    if (getaddrinfo(hostname, port, &hints, &res) != 0) {
-        perror("getaddrinfo failed");
+        if (getaddrinfo(hostname, port, &hints, &res) != 0) {
+            pthread_mutex_unlock(&pool_lock);
+            perror("getaddrinfo failed");
+            return -1;
+        }
+        if (cached != NULL) {
+            freeaddrinfo(cached);
+        }
+        cached = res;
+        snprintf(cached_host, sizeof(cached_host), "%s", hostname);
+        snprintf(cached_port, sizeof(cached_port), "%s", port);
+    }
+    *addr = *cached;
+    pthread_mutex_unlock(&pool_lock);
+    return 0;
+}
+
+// Creates a socket and connects it. A non-blocking socket returns while
+// the connect is still in progress; its result is read later with SO_ERROR.
+static int open_socket(const char *hostname, const char *port, int nonblocking) {
+    struct addrinfo addr;
+    int sockfd;
+
+    if (resolve_address(hostname, port, &addr) < 0) {
         return -1;
     }
 
-    sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    sockfd = socket(addr.ai_family, addr.ai_socktype | (nonblocking ? SOCK_NONBLOCK : 0), addr.ai_protocol);
     if (sockfd < 0) {
         perror("socket creation failed");
-        freeaddrinfo(res);
         return -1;
     }
 
-    if (connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+    if (connect(sockfd, addr.ai_addr, addr.ai_addrlen) < 0 && !(nonblocking && errno == EINPROGRESS)) {
         perror("connect failed");
         close(sockfd);
-        freeaddrinfo(res);
         return -1;
     }
 
-    freeaddrinfo(res);
+    // Requests are small single writes, don't let Nagle hold them back
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
     return sockfd;
 }
 
-// Function to send a prompt to the API and return the JSON response.
-// It is the caller's responsibility to free the returned string.
-// If anything goes wrong, return NULL.
-char * response(const char * prompt) {
-    // If library is not initialized, return NULL
-    if (!initialized) {
-        fprintf(stderr, "Not initialized\n");
-        return NULL;
+// Function to create and connect a socket to the given hostname and port.
+// The address is resolved once and reused by later connections.
+int create_socket(const char *hostname, const char *port) {
+    return open_socket(hostname, port, 0);
+}
+
+// Drops a connection (the slot stays in the pool, empty)
+static void close_connection(connection * conn) {
+    if (conn->ssl != NULL) {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
     }
-    if (api_key == NULL) {
-        return fake_response();
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
     }
-    int sockfd = create_socket(api_url, "443");
-    if (sockfd < 0) {
+}
+
+// Wraps the connected socket in TLS, resuming the last session when there is one.
+// The handshake itself is left to the caller.
+static int setup_tls(connection * conn) {
+    conn->ssl = SSL_new(tls_ctx);
+    if (conn->ssl == NULL) {
+        fprintf(stderr, "Failed to create SSL object\n");
+        return -1;
+    }
+    if (!SSL_set_tlsext_host_name(conn->ssl, api_url)) {
+        fprintf(stderr, "Failed to set SNI\n");
+        return -1;
+    }
+    if (!SSL_set_fd(conn->ssl, conn->fd)) {
+        fprintf(stderr, "Failed to set SSL file descriptor\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (tls_session != NULL) {
+        SSL_set_session(conn->ssl, tls_session);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return 0;
+}
+
+// Opens the TLS connection, resuming the last session when there is one
+static int open_connection(connection * conn) {
+    conn->fd = create_socket(api_url, api_port);
+    if (conn->fd < 0) {
         fprintf(stderr, "Failed to create socket\n");
-        return NULL;
+        return -1;
     }
-    SSL_CTX * ctx = SSL_CTX_new(TLS_client_method());
-    if (ctx == NULL) {
-        fprintf(stderr, "Failed to create SSL context\n");
-        close(sockfd);
+    if (setup_tls(conn) < 0) {
+        close_connection(conn);
+        return -1;
+    }
+
+    int connected = SSL_connect(conn->ssl);
+    if (connected <= 0) {
+        fprintf(stderr, "Failed to connect with SSL %d\n", connected);
+        ERR_print_errors_fp(stderr);
+        close_connection(conn);
+        return -1;
+    }
+    return 0;
+}
+
+// Keeps the session of a finished request for resumption by new connections.
+// With TLS 1.3 the ticket only arrives after the handshake, so this runs after a response.
+static void remember_session(SSL * ssl) {
+    SSL_SESSION * session = SSL_get1_session(ssl);
+    if (session == NULL) {
+        return;
+    }
+    if (!SSL_SESSION_is_resumable(session)) {
+        SSL_SESSION_free(session);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    SSL_SESSION * old = tls_session;
+    tls_session = session;
+    pthread_mutex_unlock(&pool_lock);
+
+    if (old != NULL) {
+        SSL_SESSION_free(old);
+    }
+}
+
+// Takes an idle kept-alive connection, or opens a new one.
+// *reused tells which, since only a reused one may have been closed by the server.
+static connection * acquire_connection(int * reused) {
+    connection * conn = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < POOL_SIZE && conn == NULL; i++) {
+        if (!pool[i].in_use && pool[i].fd >= 0) {
+            conn = &pool[i];
+        }
+    }
+    *reused = conn != NULL;
+    for (int i = 0; i < POOL_SIZE && conn == NULL; i++) {
+        if (!pool[i].in_use) {
+            conn = &pool[i];
+        }
+    }
+    if (conn != NULL) {
+        conn->in_use = 1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    // Every slot busy: a one-off connection, closed after the request
+    if (conn == NULL) {
+        conn = malloc(sizeof(*conn));
+        if (conn == NULL) {
+            return NULL;
+        }
+        conn->fd = -1;
+        conn->ssl = NULL;
+        conn->in_use = 1;
+        conn->pooled = 0;
+    }
+
+    if (!*reused && open_connection(conn) < 0) {
+        release_connection(conn, 0);
         return NULL;
     }
-    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    return conn;
+}
 
-    SSL * ssl = SSL_new(ctx);
+// Returns a connection to the pool, keeping it open if the server allows
+static void release_connection(connection * conn, int keep_alive) {
+    if (!keep_alive || !conn->pooled) {
+        close_connection(conn);
+    }
+    if (!conn->pooled) {
+        free(conn);
+        return;
+    }
 
-    if (!SSL_set_tlsext_host_name(ssl, api_url)) {
-        fprintf(stderr, "Failed to set SNI\n");
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sockfd);
+    pthread_mutex_lock(&pool_lock);
+    conn->in_use = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Sends the whole request
+static int send_all(SSL * ssl, const char * data, size_t len) {
+    while (len > 0) {
+        int sent = SSL_write(ssl, data, len > INT_MAX ? INT_MAX : (int) len);
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+// read_more() results on a non-blocking connection with nothing to read yet
+#define IO_WANT_READ -2
+#define IO_WANT_WRITE -3
+
+// Makes room for at least `more` bytes (plus a terminating NUL) after the
+// data, doubling the capacity so a long response is copied O(log n) times
+static int buffer_reserve(recv_buffer * buf, size_t more) {
+    if (buf->cap - buf->len >= more) {
+        return 0;
+    }
+    size_t cap = buf->cap ? buf->cap : READ_SIZE * 2;
+    while (cap - buf->len < more) {
+        cap *= 2;
+    }
+    char * grown = realloc(buf->data, cap + 1);
+    if (grown == NULL) {
+        fprintf(stderr, "Failed to allocate recv buffer\n");
+        return -1;
+    }
+    buf->data = grown;
+    buf->cap = cap;
+    return 0;
+}
+
+// Reads more of the response into the buffer, growing it geometrically.
+// Returns the number of bytes read, 0 when the server closed, -1 on error,
+// or IO_WANT_READ/IO_WANT_WRITE when a non-blocking connection must wait.
+static int read_more(SSL * ssl, recv_buffer * buf) {
+    if (buffer_reserve(buf, READ_SIZE) < 0) {
+        return -1;
+    }
+
+    int bytes = SSL_read(ssl, buf->data + buf->len, (int) (buf->cap - buf->len));
+    if (bytes <= 0) {
+        int error = SSL_get_error(ssl, bytes);
+        if (error == SSL_ERROR_WANT_READ) {
+            return IO_WANT_READ;
+        }
+        if (error == SSL_ERROR_WANT_WRITE) {
+            return IO_WANT_WRITE;
+        }
+        return (error == SSL_ERROR_ZERO_RETURN || error == SSL_ERROR_SYSCALL) && bytes == 0 ? 0 : -1;
+    }
+    buf->len += bytes;
+    return bytes;
+}
+
+// Case-insensitive check of a header line's name, returns its value or NULL
+static const char * header_value(const char * line, const char * name) {
+    size_t n = strlen(name);
+    if (strncasecmp(line, name, n) != 0 || line[n] != ':') {
         return NULL;
     }
+    line += n + 1;
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    return line;
+}
 
-    if (ssl == NULL) {
-        fprintf(stderr, "Failed to create SSL object\n");
-        SSL_CTX_free(ctx);
-        close(sockfd);
+// Incremental HTTP response parser. It is fed the whole receive buffer each
+// time more arrives and picks up where it stopped, so the blocking and the
+// asynchronous paths share it.
+enum { HTTP_HEADERS, HTTP_BODY, HTTP_CHUNK_SIZE, HTTP_CHUNK_DATA, HTTP_TRAILERS };
+
+typedef struct {
+    int phase;
+    int status;             // HTTP status code
+    size_t scanned;         // where to resume looking for the end of the headers
+    size_t body_start;
+    size_t body_len;        // decoded so far for a chunked body
+    long content_length;    // -1 when not given
+    int keep_alive;
+    size_t chunk_in;        // next undecoded byte of a chunked body
+    size_t chunk_size;
+} http_parser;
+
+static void http_parser_init(http_parser * p) {
+    memset(p, 0, sizeof(*p));
+    p->phase = HTTP_HEADERS;
+    p->content_length = -1;
+}
+
+// Reads the status line and headers, which end at buf->data + end
+static int http_parse_headers(http_parser * p, recv_buffer * buf, char * end) {
+    p->body_start = end - buf->data + 4;
+    *end = '\0';
+
+    // status line, then one header per line
+    if (strncmp(buf->data, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+    p->keep_alive = buf->data[7] == '1';
+    p->status = atoi(buf->data + 8);
+
+    int chunked = 0;
+    for (char * line = strstr(buf->data, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        const char * value;
+        line += 2;
+        if ((value = header_value(line, "Content-Length")) != NULL) {
+            p->content_length = strtol(value, NULL, 10);
+        } else if ((value = header_value(line, "Transfer-Encoding")) != NULL) {
+            chunked = strncasecmp(value, "chunked", 7) == 0;
+        } else if ((value = header_value(line, "Connection")) != NULL) {
+            if (strncasecmp(value, "close", 5) == 0) {
+                p->keep_alive = 0;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                p->keep_alive = 1;
+            }
+        }
+    }
+
+    p->phase = chunked ? HTTP_CHUNK_SIZE : HTTP_BODY;
+    p->chunk_in = p->body_start;
+    return 0;
+}
+
+// Parses as much of the response as has arrived; eof tells the server closed.
+// Returns 1 when the response is complete, 0 when more is needed, -1 on error.
+// The body is framed by Content-Length, chunked encoding (decoded in place,
+// chunks moved down over their size lines) or the end of the connection.
+static int http_parse(http_parser * p, recv_buffer * buf, int eof) {
+    if (p->phase == HTTP_HEADERS) {
+        char * end = buf->len > p->scanned ? memmem(buf->data + p->scanned, buf->len - p->scanned, "\r\n\r\n", 4) : NULL;
+        if (end == NULL) {
+            p->scanned = buf->len > 3 ? buf->len - 3 : 0;
+            return eof ? -1 : 0;
+        }
+        if (http_parse_headers(p, buf, end) < 0) {
+            return -1;
+        }
+    }
+
+    if (p->phase == HTTP_BODY) {
+        if (p->content_length >= 0) {
+            if (buf->len - p->body_start < (size_t) p->content_length) {
+                return eof ? -1 : 0;
+            }
+            p->body_len = p->content_length;
+            return 1;
+        }
+        // no framing: the body ends with the connection
+        if (!eof) {
+            return 0;
+        }
+        p->keep_alive = 0;
+        p->body_len = buf->len - p->body_start;
+        return 1;
+    }
+
+    for (;;) {
+        if (p->phase == HTTP_CHUNK_DATA) {
+            if (buf->len - p->chunk_in < p->chunk_size + 2) {
+                return eof ? -1 : 0;
+            }
+            memmove(buf->data + p->body_start + p->body_len, buf->data + p->chunk_in, p->chunk_size);
+            p->body_len += p->chunk_size;
+            p->chunk_in += p->chunk_size + 2;
+            p->phase = HTTP_CHUNK_SIZE;
+            continue;
+        }
+
+        // a chunk size line, or a trailer line after the last chunk
+        char * eol = buf->len > p->chunk_in ? memmem(buf->data + p->chunk_in, buf->len - p->chunk_in, "\r\n", 2) : NULL;
+        if (eol == NULL) {
+            return eof ? -1 : 0;
+        }
+        char * line = buf->data + p->chunk_in;
+        p->chunk_in = (eol - buf->data) + 2;
+
+        if (p->phase == HTTP_TRAILERS) {
+            if (eol == line) {
+                return 1;
+            }
+            continue;
+        }
+        p->chunk_size = strtoul(line, NULL, 16);
+        p->phase = p->chunk_size ? HTTP_CHUNK_DATA : HTTP_TRAILERS;
+    }
+}
+
+// Number of body bytes decoded so far
+static size_t http_body_ready(const http_parser * p, const recv_buffer * buf) {
+    switch (p->phase) {
+    case HTTP_HEADERS:
+        return 0;
+    case HTTP_BODY:
+        if (p->content_length >= 0 && buf->len - p->body_start > (size_t) p->content_length) {
+            return p->content_length;
+        }
+        return buf->len - p->body_start;
+    default:
+        return p->body_len;
+    }
+}
+
+// Reads one HTTP response on a blocking connection. With a stream, the
+// body is handed over as it arrives.
+static int read_response(SSL * ssl, recv_buffer * buf, http_parser * parser, sse_stream * stream) {
+    int eof = 0;
+
+    http_parser_init(parser);
+    for (;;) {
+        int parsed = http_parse(parser, buf, eof);
+        if (parsed >= 0 && stream != NULL) {
+            sse_feed(stream, buf->data + parser->body_start, http_body_ready(parser, buf));
+        }
+        if (parsed != 0) {
+            return parsed > 0 ? 0 : -1;
+        }
+        int bytes = read_more(ssl, buf);
+        if (bytes < 0) {
+            return -1;
+        }
+        eof = bytes == 0;
+    }
+}
+
+// ---- Response cache ----
+//
+// Optional, off until response_cache_enable(). Responses are keyed by the
+// SHA-256 of the request body, so the prompt, model and max_tokens all
+// count. Recent ones stay in memory in LRU order; with a directory every
+// response is also written to <dir>/<key>.json and read back with mmap
+// after a restart. Entries older than the TTL are dropped, and each store
+// is kept under the size limit by evicting the oldest entries.
+
+#define CACHE_KEY_SIZE 32       // SHA-256
+#define CACHE_BUCKETS 4096
+#define CACHE_DEFAULT_TTL (24 * 60 * 60)
+#define CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+typedef struct cache_entry {
+    unsigned char key[CACHE_KEY_SIZE];
+    char * data;
+    size_t len;
+    time_t stored;
+    struct cache_entry * chain;     // next in the same bucket
+    struct cache_entry * newer;     // LRU neighbours
+    struct cache_entry * older;
+} cache_entry;
+
+static int cache_enabled = 0;
+static char * cache_dir = NULL;     // NULL for a memory-only cache
+static int cache_ttl = CACHE_DEFAULT_TTL;
+static size_t cache_max_bytes = CACHE_DEFAULT_SIZE;
+static size_t cache_bytes = 0;      // in memory
+static size_t cache_disk_bytes = 0;
+static cache_entry * cache_table[CACHE_BUCKETS];
+static cache_entry * cache_newest = NULL;
+static cache_entry * cache_oldest = NULL;
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_key(const char * body, size_t len, unsigned char * key) {
+    EVP_Digest(body, len, key, NULL, EVP_sha256(), NULL);
+}
+
+static cache_entry ** cache_bucket(const unsigned char * key) {
+    return &cache_table[(key[0] | key[1] << 8 | key[2] << 16) % CACHE_BUCKETS];
+}
+
+static void cache_path(const char * dir, const unsigned char * key, char * path, size_t size) {
+    int n = snprintf(path, size, "%s/", dir);
+    for (int i = 0; i < CACHE_KEY_SIZE && n + 3 < (int) size; i++) {
+        n += snprintf(path + n, size - n, "%02x", key[i]);
+    }
+    snprintf(path + n, size - n, ".json");
+}
+
+static void cache_lru_unlink(cache_entry * e) {
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        cache_newest = e->older;
+    }
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        cache_oldest = e->newer;
+    }
+}
+
+static void cache_lru_push(cache_entry * e) {
+    e->newer = NULL;
+    e->older = cache_newest;
+    if (cache_newest != NULL) {
+        cache_newest->newer = e;
+    } else {
+        cache_oldest = e;
+    }
+    cache_newest = e;
+}
+
+static void cache_remove(cache_entry * e) {
+    cache_entry ** link = cache_bucket(e->key);
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+    cache_lru_unlink(e);
+    cache_bytes -= e->len;
+    free(e->data);
+    free(e);
+}
+
+static cache_entry * cache_find(const unsigned char * key) {
+    for (cache_entry * e = *cache_bucket(key); e != NULL; e = e->chain) {
+        if (memcmp(e->key, key, CACHE_KEY_SIZE) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Adds a response to the memory store, taking ownership of data
+static void cache_insert(const unsigned char * key, char * data, size_t len, time_t stored) {
+    cache_entry * e = cache_find(key);
+    if (e != NULL) {
+        cache_remove(e);
+    }
+    if (len > cache_max_bytes || (e = malloc(sizeof(*e))) == NULL) {
+        free(data);
+        return;
+    }
+    while (cache_bytes + len > cache_max_bytes) {
+        cache_remove(cache_oldest);
+    }
+
+    memcpy(e->key, key, CACHE_KEY_SIZE);
+    e->data = data;
+    e->len = len;
+    e->stored = stored;
+    cache_entry ** bucket = cache_bucket(key);
+    e->chain = *bucket;
+    *bucket = e;
+    cache_lru_push(e);
+    cache_bytes += len;
+}
+
+// Reads a stored response back from disk, NULL if missing or expired
+static char * cache_load(const char * dir, const unsigned char * key, size_t * len, time_t * stored) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    cache_path(dir, key, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         return NULL;
     }
-    if (!SSL_set_fd(ssl, sockfd)) {
-        fprintf(stderr, "Failed to set SSL file descriptor\n");
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sockfd);
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
         return NULL;
     }
-    int connected = SSL_connect(ssl);
-    if (connected <= 0) {
-        fprintf(stderr, "Failed to connect with SSL %d\n", connected);
-        ERR_print_errors_fp(stderr);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sockfd);
+    if (time(NULL) - st.st_mtime > cache_ttl) {
+        close(fd);
+        unlink(path);
         return NULL;
     }
 
-    // Send the prompt to the API
-    char * message, * body;
-    int result;
-    result = asprintf(
-        &body,
-        "{\"messages\": [{\"role\": \"user\", \"content\": \"%s\"}], \"model\": \"%s\", \"max_tokens\": %d}",
-        prompt,
-        model,
-        max_tokens
-    );
-    if (result < 0) {
-        fprintf(stderr, "Failed to allocate prompt\n");
+    char * data = NULL;
+    void * mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped != MAP_FAILED) {
+        // the whole file, even past a NUL byte, so that len stays true
+        data = malloc(st.st_size + 1);
+        if (data != NULL) {
+            memcpy(data, mapped, st.st_size);
+            data[st.st_size] = '\0';
+        }
+        munmap(mapped, st.st_size);
+    }
+    *len = st.st_size;
+    *stored = st.st_mtime;
+    return data;
+}
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    time_t mtime;
+    size_t size;
+} cache_file;
+
+static int cache_file_older(const void * a, const void * b) {
+    time_t x = ((const cache_file *) a)->mtime, y = ((const cache_file *) b)->mtime;
+    return (x > y) - (x < y);
+}
+
+// Recounts the disk store, dropping expired files and, over the size
+// limit, the oldest ones until it is back to three quarters of it
+static void cache_scan_disk() {
+    DIR * dir = opendir(cache_dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    cache_file * files = NULL;
+    size_t count = 0, cap = 0, total = 0;
+    time_t now = time(NULL);
+    struct dirent * ent;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t n = strlen(ent->d_name);
+        struct stat st;
+        if (n != CACHE_KEY_SIZE * 2 + 5 || strcmp(ent->d_name + n - 5, ".json") != 0 ||
+            fstatat(dirfd(dir), ent->d_name, &st, 0) < 0) {
+            continue;
+        }
+        if (now - st.st_mtime > cache_ttl) {
+            unlinkat(dirfd(dir), ent->d_name, 0);
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 256;
+            cache_file * grown = realloc(files, cap * sizeof(*files));
+            if (grown == NULL) {
+                break;
+            }
+            files = grown;
+        }
+        memcpy(files[count].name, ent->d_name, n + 1);
+        files[count].mtime = st.st_mtime;
+        files[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+
+    if (total > cache_max_bytes) {
+        qsort(files, count, sizeof(*files), cache_file_older);
+        for (size_t i = 0; i < count && total > cache_max_bytes / 4 * 3; i++) {
+            unlinkat(dirfd(dir), files[i].name, 0);
+            total -= files[i].size;
+        }
+    }
+    cache_disk_bytes = total;
+    free(files);
+    closedir(dir);
+}
+
+// Writes a response to the disk store. It goes to a temporary file first
+// so that concurrent processes never read half a response.
+static void cache_save(const char * dir, const unsigned char * key, const char * data, size_t len) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+
+    cache_path(dir, key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s/.tmpXXXXXX", dir);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    close(fd);
+    if (written < len || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    cache_disk_bytes += len;
+    if (cache_disk_bytes > cache_max_bytes) {
+        cache_scan_disk();
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Returns a copy of the cached response for the key, NULL on a miss
+static char * cache_lookup(const unsigned char * key) {
+    char * copy = NULL;
+    char * dir = NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    cache_entry * e = cache_find(key);
+    if (e != NULL && time(NULL) - e->stored > cache_ttl) {
+        cache_remove(e);
+        e = NULL;
+    }
+    if (e != NULL) {
+        cache_lru_unlink(e);
+        cache_lru_push(e);
+        copy = malloc(e->len + 1);
+        if (copy != NULL) {
+            memcpy(copy, e->data, e->len + 1);
+        }
+    } else if (cache_dir != NULL) {
+        // response_cache_enable() may replace cache_dir once the lock is released
+        dir = strdup(cache_dir);
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // Not in memory: try the disk store, and keep what is found in memory
+    if (copy == NULL && dir != NULL) {
+        size_t len;
+        time_t stored;
+        char * data = cache_load(dir, key, &len, &stored);
+        if (data != NULL && (copy = malloc(len + 1)) != NULL) {
+            memcpy(copy, data, len + 1);
+            pthread_mutex_lock(&cache_lock);
+            cache_insert(key, data, len, stored);
+            pthread_mutex_unlock(&cache_lock);
+        } else {
+            free(data);
+        }
+    }
+    free(dir);
+
+    pthread_mutex_lock(&cache_lock);
+    if (copy != NULL) {
+        cache_hits++;
+    } else {
+        cache_misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return copy;
+}
+
+// Caches a successful response
+static void cache_store(const unsigned char * key, const char * response, size_t len) {
+    char * copy = malloc(len + 1);
+    if (copy == NULL) {
+        return;
+    }
+    memcpy(copy, response, len);
+    copy[len] = '\0';
+    pthread_mutex_lock(&cache_lock);
+    char * dir = cache_dir != NULL ? strdup(cache_dir) : NULL;
+    pthread_mutex_unlock(&cache_lock);
+    if (dir != NULL) {
+        cache_save(dir, key, response, len);
+        free(dir);
+    }
+    pthread_mutex_lock(&cache_lock);
+    cache_insert(key, copy, len, time(NULL));
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Turns the response cache on. dir may be NULL for a memory-only cache.
+// Returns 0, or -1 if the directory cannot be created.
+int response_cache_enable(const char * dir, int ttl_seconds, size_t max_bytes) {
+    if (dir != NULL && mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("Failed to create cache directory");
+        return -1;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    free(cache_dir);
+    cache_dir = dir != NULL ? strdup(dir) : NULL;
+    cache_ttl = ttl_seconds > 0 ? ttl_seconds : CACHE_DEFAULT_TTL;
+    cache_max_bytes = max_bytes > 0 ? max_bytes : CACHE_DEFAULT_SIZE;
+    while (cache_bytes > cache_max_bytes) {
+        cache_remove(cache_oldest);
+    }
+    if (cache_dir != NULL) {
+        cache_scan_disk();
+    }
+    cache_enabled = 1;
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+}
+
+// Reports the cache hits and misses so far
+void response_cache_stats(unsigned long * hits, unsigned long * misses) {
+    pthread_mutex_lock(&cache_lock);
+    *hits = cache_hits;
+    *misses = cache_misses;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// ---- Request bodies ----
+//
+// Requests are written by a small JSON writer straight into one buffer:
+// room for the headers first, then the body. Once the body is done its
+// length is known, and the headers are written into the room just before
+// it, so the message goes out as one contiguous piece without copying.
+
+// Room for the request headers, on top of the host and the key
+#define HEADER_ROOM 256
+
+static void writer_reserve(json_writer * w, size_t more) {
+    if (w->cap - w->len >= more) {
+        return;
+    }
+    size_t cap = w->cap ? w->cap : 1024;
+    while (cap - w->len < more) {
+        cap *= 2;
+    }
+    char * grown = realloc(w->data, cap);
+    if (grown == NULL) {
+        fprintf(stderr, "Failed to allocate message\n");
         exit(1);
     }
-    result = asprintf(
-        &message,
-        "POST /v1/chat/completions HTTP/1.1\n"
-        "Host: %s\n"
-        "Authorization: Bearer %s\n"
-        "Content-Type: application/json\n"
-        "User-Agent: DIT-Neurolib/1.0\n"
-        "Accept: application/json\n"
-        "Content-Length: %lu\n"
-        "\n"
-        "%s\n\n",
+    w->data = grown;
+    w->cap = cap;
+}
+
+static void writer_raw(json_writer * w, const char * text, size_t len) {
+    writer_reserve(w, len);
+    memcpy(w->data + w->len, text, len);
+    w->len += len;
+}
+
+#define writer_literal(w, text) writer_raw(w, text, sizeof(text) - 1)
+
+// Writes text as a quoted JSON string. Runs of plain characters are
+// copied in one go; quotes, backslashes and control characters are escaped.
+static void writer_string(json_writer * w, const char * text) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char * s = (const unsigned char *) text;
+
+    writer_literal(w, "\"");
+    for (;;) {
+        const unsigned char * run = s;
+        while (*s >= 0x20 && *s != '"' && *s != '\\') {
+            s++;
+        }
+        writer_raw(w, (const char *) run, s - run);
+        if (*s == '\0') {
+            break;
+        }
+
+        char escaped[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t len = 2;
+        switch (*s) {
+        case '"': escaped[1] = '"'; break;
+        case '\\': escaped[1] = '\\'; break;
+        case '\b': escaped[1] = 'b'; break;
+        case '\f': escaped[1] = 'f'; break;
+        case '\n': escaped[1] = 'n'; break;
+        case '\r': escaped[1] = 'r'; break;
+        case '\t': escaped[1] = 't'; break;
+        default:
+            memcpy(escaped + 1, "u00", 3);
+            escaped[4] = hex[*s >> 4];
+            escaped[5] = hex[*s & 15];
+            len = 6;
+        }
+        writer_raw(w, escaped, len);
+        s++;
+    }
+    writer_literal(w, "\"");
+}
+
+// Writes one chat message object
+static void writer_message(json_writer * w, const char * role, const char * content) {
+    writer_literal(w, "{\"role\": ");
+    writer_string(w, role);
+    writer_literal(w, ", \"content\": ");
+    writer_string(w, content);
+    writer_literal(w, "}");
+}
+
+// Starts a request in w: room for the headers, then the body up to the
+// messages. Returns where the body starts.
+static size_t request_begin(json_writer * w) {
+    size_t room = HEADER_ROOM + strlen(api_url) + strlen(api_key);
+    w->len = 0;
+    writer_reserve(w, room);
+    w->len = room;
+    writer_literal(w, "{\"messages\": [");
+    return room;
+}
+
+// Ends the body after the messages and puts the headers in front of it.
+// stream asks for the reply as server-sent events. Returns the start of
+// the message, *len is set to its length. With the cache on, key
+// receives the cache key of the body.
+static const char * request_end(json_writer * w, size_t body_start, int stream, size_t * len, unsigned char * key) {
+    char tail[32];
+    writer_literal(w, "]");
+    if (stream) {
+        writer_literal(w, ", \"stream\": true");
+    }
+    writer_literal(w, ", \"model\": ");
+    writer_string(w, model);
+    int n = snprintf(tail, sizeof(tail), ", \"max_tokens\": %d}", max_tokens);
+    writer_raw(w, tail, n);
+
+    size_t body_len = w->len - body_start;
+    if (cache_enabled) {
+        cache_key(w->data + body_start, body_len, key);
+    }
+
+    int header_len = snprintf(
+        w->data,
+        body_start,
+        "POST /v1/chat/completions HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Authorization: Bearer %s\r\n"
+        "Content-Type: application/json\r\n"
+        "User-Agent: DIT-Neurolib/1.0\r\n"
+        "Accept: application/json\r\n"
+        "Connection: keep-alive\r\n"
+        "Content-Length: %lu\r\n"
+        "\r\n",
         api_url,
         api_key,
-        strlen(body),
-        body
+        (unsigned long) body_len
     );
-    if (result < 0) {
+    if (header_len < 0 || (size_t) header_len >= body_start) {
         fprintf(stderr, "Failed to allocate message\n");
         exit(1);
     }
-    int sent = SSL_write(ssl, message, strlen(message));
 
-    free(message);
-    free(body);
+    char * message = w->data + body_start - header_len;
+    memmove(message, w->data, header_len);
+    *len = header_len + body_len;
+    return message;
+}
 
-    if (sent < 0) {
-        fprintf(stderr, "Failed to send message\n");
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sockfd);
-        return NULL;
+// Builds the request for a single prompt in w
+static const char * build_request(json_writer * w, const char * prompt, size_t * len, unsigned char * key) {
+    size_t body_start = request_begin(w);
+    writer_message(w, "user", prompt);
+    return request_end(w, body_start, 0, len, key);
+}
+
+// Largest receive buffer kept between calls. A bigger one is freed, so a
+// single huge response doesn't pin its memory for the thread's lifetime.
+#define RECV_KEEP_SIZE (1024 * 1024)
+
+// Receive buffer and request buffer reused by every blocking request of the thread
+static _Thread_local recv_buffer thread_buf = {NULL, 0, 0};
+static _Thread_local json_writer thread_request = {NULL, 0, 0};
+
+// The buffers are freed when their thread exits, by the destructor of a key
+// that is set once per thread (_Thread_local alone would leak them)
+static pthread_key_t thread_buffers_key;
+static pthread_once_t thread_buffers_once = PTHREAD_ONCE_INIT;
+static _Thread_local int thread_buffers_registered = 0;
+
+// Runs on the exiting thread, so its buffers are still the ones in scope
+static void free_thread_buffers(void * unused) {
+    (void) unused;
+    free(thread_buf.data);
+    free(thread_request.data);
+    memset(&thread_buf, 0, sizeof(thread_buf));
+    memset(&thread_request, 0, sizeof(thread_request));
+}
+
+static void create_thread_buffers_key(void) {
+    pthread_key_create(&thread_buffers_key, free_thread_buffers);
+}
+
+// Called before the thread's buffers are first used
+static void register_thread_buffers(void) {
+    if (!thread_buffers_registered) {
+        thread_buffers_registered = 1;
+        pthread_once(&thread_buffers_once, create_thread_buffers_key);
+        // any non-NULL value, the destructor only runs for those
+        pthread_setspecific(thread_buffers_key, &thread_buf);
     }
-    // Receive the entire response with repeated calls to recv + realloc as needed
-    char * buffer = NULL;
-    int buffer_size = 0;
-    int received = 0;
-    while (1) {
-        char temp[1024];
-        int bytes = SSL_read(ssl, temp, sizeof(temp));
-        if (bytes <= 0) {
-            break;
+}
+
+// Empties the buffer for the next response, keeping its memory
+static void buffer_reset(recv_buffer * buf) {
+    if (buf->cap > RECV_KEEP_SIZE) {
+        free(buf->data);
+        buf->data = NULL;
+        buf->cap = 0;
+    }
+    buf->len = 0;
+}
+
+// Sends the request and reads the response into buf, streaming it if asked
+static int exchange(const char * message, size_t length, recv_buffer * buf, http_parser * parser, sse_stream * stream) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused;
+        connection * conn = acquire_connection(&reused);
+        if (conn == NULL) {
+            return -1;
         }
-        buffer = realloc(buffer, buffer_size + bytes);
-        if (buffer == NULL) {
-            fprintf(stderr, "Failed to allocate recv buffer\n");
-            exit(1);
+
+        buffer_reset(buf);
+        int failed = send_all(conn->ssl, message, length) < 0 ||
+                     read_response(conn->ssl, buf, parser, stream) < 0;
+
+        if (failed) {
+            release_connection(conn, 0);
+            // A kept-alive connection may have been closed by the server while
+            // idle; that shows up before any byte arrives, so retry on a fresh one
+            if (reused && buf->len == 0) {
+                continue;
+            }
+            fprintf(stderr, "Failed to receive response\n");
+            return -1;
         }
-        memcpy(buffer + buffer_size, temp, bytes);
-        buffer_size += bytes;
-        received += bytes;
+
+        remember_session(conn->ssl);
+        release_connection(conn, parser->keep_alive);
+
+        // the body is a C string where it lies
+        buf->data[parser->body_start + parser->body_len] = '\0';
+        return 0;
     }
-    // Null terminate the buffer
-    buffer = realloc(buffer, buffer_size + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Failed to allocate recv buffer\n");
-        exit(1);
+    return -1;
+}
+
+// Runs a blocking request for the prompt, or for the whole history when
+// it is given. The response is either left in buf, located by parser, or,
+// for fake and cached responses, returned in *direct.
+static int fetch(const char * prompt, const json_writer * history, recv_buffer * buf, http_parser * parser, char ** direct) {
+    *direct = NULL;
+
+    // If library is not initialized, fail
+    if (!initialized) {
+        fprintf(stderr, "Not initialized\n");
+        return -1;
+    }
+    if (api_key == NULL) {
+        *direct = fake_response();
+        return 0;
+    }
+    if (tls_ctx == NULL) {
+        fprintf(stderr, "Failed to create SSL context\n");
+        return -1;
+    }
+
+    size_t length;
+    unsigned char key[CACHE_KEY_SIZE];
+    const char * message;
+    register_thread_buffers();
+    if (history != NULL) {
+        size_t body_start = request_begin(&thread_request);
+        writer_raw(&thread_request, history->data, history->len);
+        message = request_end(&thread_request, body_start, 0, &length, key);
+    } else {
+        message = build_request(&thread_request, prompt, &length, key);
     }
-    buffer[buffer_size] = '\0';
 
-    // Filter out HTTP response headers and return only the JSON response
-    // JSON response starts with the first '{' character and ends with the last '}'
-    char * response = NULL;
-    char * start = strchr(buffer, '{');
-    char * end = strrchr(buffer, '}');
-    if (start != NULL && end != NULL) {
-        response = strndup(start, end - start + 1);
+    if (cache_enabled && (*direct = cache_lookup(key)) != NULL) {
+        return 0;
     }
+
+    int result = exchange(message, length, buf, parser, NULL);
+    if (result == 0 && cache_enabled && parser->status == 200) {
+        cache_store(key, buf->data + parser->body_start, parser->body_len);
+    }
+    return result;
+}
+
+// Function to send a prompt to the API and return the JSON response.
+// It is the caller's responsibility to free the returned string.
+// If anything goes wrong, return NULL.
+char * response(const char * prompt) {
+    http_parser parser;
+    char * direct;
+
+    if (fetch(prompt, NULL, &thread_buf, &parser, &direct) < 0) {
+        return NULL;
+    }
+    if (direct != NULL) {
+        return direct;
+    }
+
+    char * response = strndup(thread_buf.data + parser.body_start, parser.body_len);
     if (response == NULL) {
         fprintf(stderr, "Failed to parse response\n");
     }
-
-    // Free up all state
-    free(buffer);
-    close(sockfd);
-    SSL_free(ssl);
-    SSL_CTX_free(ctx);
     return response;
 }
+
+// Returns the response body for the prompt or the history in the thread's
+// receive buffer
+static const char * body_view(const char * prompt, const json_writer * history, size_t * len) {
+    recv_buffer * buf = &thread_buf;
+    http_parser parser;
+    char * direct;
+
+    if (fetch(prompt, history, buf, &parser, &direct) < 0) {
+        return NULL;
+    }
+    if (direct == NULL) {
+        *len = parser.body_len;
+        return buf->data + parser.body_start;
+    }
+
+    // fake and cached responses are moved into the buffer, so that every
+    // view is released the same way
+    size_t size = strlen(direct);
+    buffer_reset(buf);
+    if (buffer_reserve(buf, size) < 0) {
+        free(direct);
+        return NULL;
+    }
+    memcpy(buf->data, direct, size + 1);
+    free(direct);
+    buf->len = size;
+    *len = size;
+    return buf->data;
+}
+
+// Same as response(), without copying the body out of the receive buffer.
+// The returned string lies in a buffer owned by the calling thread and
+// stays valid until the thread's next request.
+const char * response_body(const char * prompt, size_t * len) {
+    return body_view(prompt, NULL, len);
+}
+
+// A conversation keeps its messages already serialized, so each request
+// only appends the new turns instead of writing the whole history again
+struct conversation {
+    json_writer history;    // message objects, comma separated
+    size_t last_start;      // history length before the last turn
+    int has_last;           // there is a turn conversation_drop_last() can remove
+};
+
+// Starts an empty conversation
+conversation * conversation_new() {
+    conversation * chat = calloc(1, sizeof(*chat));
+    if (chat == NULL) {
+        fprintf(stderr, "Failed to allocate conversation\n");
+    }
+    return chat;
+}
+
+// Adds a turn ("user", "assistant" or "system") to the conversation
+void conversation_add(conversation * chat, const char * role, const char * content) {
+    chat->last_start = chat->history.len;
+    chat->has_last = 1;
+    if (chat->history.len > 0) {
+        writer_literal(&chat->history, ", ");
+    }
+    writer_message(&chat->history, role, content);
+}
+
+// Drops the last turn by cutting the history back to where it began
+void conversation_drop_last(conversation * chat) {
+    if (chat->has_last) {
+        chat->history.len = chat->last_start;
+        chat->has_last = 0;
+    }
+}
+
+// Sends the whole conversation and returns the response body like
+// response_body(): in the thread's receive buffer, valid until its next request
+const char * conversation_response(conversation * chat, size_t * len) {
+    return body_view(NULL, &chat->history, len);
+}
+
+void conversation_free(conversation * chat) {
+    if (chat != NULL) {
+        free(chat->history.data);
+        free(chat);
+    }
+}
+
+// ---- Streaming ----
+//
+// With "stream": true the API sends the reply as server-sent events, one
+// "data: {json}" line per token and "data: [DONE]" at the end. The events
+// are split out of the body as it is decoded, while the rest is still on
+// the way, and the text of each one goes to the caller's callback.
+
+struct sse_stream {
+    token_callback on_token;
+    void * ctx;
+    const json_path * path; // where the text of an event is
+    size_t pos;             // body bytes already split into lines
+    json_writer text;       // the whole reply so far
+};
+
+// Appends the text of an event (a delta, or a whole message) to the reply
+// and hands it to the callback. null text, a missing key or a broken event
+// add nothing.
+static void sse_content(sse_stream * stream, const char * data, size_t len) {
+    json_extractor ex;
+    json_extractor_init(&ex, stream->path, 1);
+    int status = json_extractor_feed(&ex, data, len);
+    if (status == JSON_CONTINUE) {
+        status = json_extractor_finish(&ex);
+    }
+
+    if (status == JSON_FOUND && ex.value_is_string && ex.value_len > 0) {
+        writer_raw(&stream->text, ex.value, ex.value_len);
+        if (stream->on_token != NULL) {
+            stream->on_token(stream->text.data + stream->text.len - ex.value_len, ex.value_len, stream->ctx);
+        }
+    }
+    json_extractor_free(&ex);
+}
+
+// Splits the newly decoded part of the body into lines and handles each
+// complete "data:" line
+static void sse_feed(sse_stream * stream, const char * body, size_t len) {
+    const char * eol;
+    while (stream->pos < len && (eol = memchr(body + stream->pos, '\n', len - stream->pos)) != NULL) {
+        const char * line = body + stream->pos;
+        size_t n = eol - line;
+        stream->pos += n + 1;
+
+        if (n > 0 && line[n - 1] == '\r') {
+            n--;
+        }
+        if (n < 5 || memcmp(line, "data:", 5) != 0) {
+            continue;   // blank lines end events; comments and other fields are unused
+        }
+        line += 5;
+        n -= 5;
+        if (n > 0 && *line == ' ') {
+            line++;
+            n--;
+        }
+        if (n == 6 && memcmp(line, "[DONE]", 6) == 0) {
+            continue;
+        }
+        sse_content(stream, line, n);
+    }
+}
+
+// Runs a streamed request for the prompt or the whole history.
+// Returns the whole reply, or NULL if anything goes wrong.
+static char * stream_request(const char * prompt, const json_writer * history, token_callback on_token, void * ctx) {
+    sse_stream stream = {on_token, ctx, &delta_path, 0, {NULL, 0, 0}};
+
+    if (!initialized) {
+        fprintf(stderr, "Not initialized\n");
+        return NULL;
+    }
+    if (api_key == NULL) {
+        // the fake reply arrives in one piece
+        char * fake = fake_response();
+        stream.path = &message_path;
+        sse_content(&stream, fake, strlen(fake));
+        free(fake);
+    } else {
+        if (tls_ctx == NULL) {
+            fprintf(stderr, "Failed to create SSL context\n");
+            return NULL;
+        }
+
+        size_t length;
+        unsigned char key[CACHE_KEY_SIZE];
+        register_thread_buffers();
+        size_t body_start = request_begin(&thread_request);
+        if (history != NULL) {
+            writer_raw(&thread_request, history->data, history->len);
+        } else {
+            writer_message(&thread_request, "user", prompt);
+        }
+        const char * message = request_end(&thread_request, body_start, 1, &length, key);
+
+        http_parser parser;
+        if (exchange(message, length, &thread_buf, &parser, &stream) < 0) {
+            free(stream.text.data);
+            return NULL;
+        }
+        if (parser.status != 200) {
+            fprintf(stderr, "API error %d: %s\n", parser.status, thread_buf.data + parser.body_start);
+            free(stream.text.data);
+            return NULL;
+        }
+    }
+
+    writer_literal(&stream.text, "\0");
+    return stream.text.data;
+}
+
+// Sends a prompt and delivers the reply token by token as it is generated.
+// Returns the whole reply, to be freed by the caller, or NULL on failure.
+char * response_stream(const char * prompt, token_callback on_token, void * ctx) {
+    return stream_request(prompt, NULL, on_token, ctx);
+}
+
+// Sends the whole conversation like response_stream()
+char * conversation_stream(conversation * chat, token_callback on_token, void * ctx) {
+    return stream_request(NULL, &chat->history, on_token, ctx);
+}
+
+// ---- Asynchronous requests ----
+//
+// Every request is a small state machine driven by one epoll loop:
+// connect -> TLS handshake -> send -> receive. Nothing blocks, so many
+// requests can be in flight on one thread. Requests over the in-flight
+// limit wait in a queue. The async API is not thread-safe: call it from
+// one thread only.
+
+#define ASYNC_DEFAULT_INFLIGHT 16
+#define ASYNC_IDLE_SIZE 64      // kept-alive non-blocking connections
+#define ASYNC_EVENTS 64
+
+enum { REQ_CONNECTING, REQ_HANDSHAKE, REQ_SENDING, REQ_RECEIVING };
+
+typedef struct async_request {
+    int state;
+    json_writer out;          // holds the message
+    const char * message;
+    size_t length;
+    size_t sent;
+    response_callback callback;
+    void * ctx;
+    connection conn;
+    int reused;               // running on a kept-alive connection
+    int retried;
+    int watched;              // registered with epoll
+    recv_buffer buf;
+    http_parser parser;
+    char * result;            // set once finished
+    unsigned char key[CACHE_KEY_SIZE];
+    struct async_request * next;
+} async_request;
+
+// A simple FIFO of requests
+typedef struct {
+    async_request * head;
+    async_request * tail;
+} request_list;
+
+static int epoll_fd = -1;
+static int max_inflight = ASYNC_DEFAULT_INFLIGHT;
+static int inflight = 0;
+static request_list waiting = {NULL, NULL};    // over the in-flight limit
+static request_list finished = {NULL, NULL};   // callbacks still to run
+static connection idle[ASYNC_IDLE_SIZE];
+static int idle_count = 0;
+
+static void list_push(request_list * list, async_request * req) {
+    req->next = NULL;
+    if (list->tail != NULL) {
+        list->tail->next = req;
+    } else {
+        list->head = req;
+    }
+    list->tail = req;
+}
+
+static async_request * list_pop(request_list * list) {
+    async_request * req = list->head;
+    if (req != NULL) {
+        list->head = req->next;
+        if (list->head == NULL) {
+            list->tail = NULL;
+        }
+    }
+    return req;
+}
+
+// Waits for the connection to become readable or writable
+static int async_watch(async_request * req, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = req;
+    if (epoll_ctl(epoll_fd, req->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, req->conn.fd, &event) < 0) {
+        perror("epoll_ctl failed");
+        return -1;
+    }
+    req->watched = 1;
+    return 0;
+}
+
+static void async_unwatch(async_request * req) {
+    if (req->watched) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, req->conn.fd, NULL);
+        req->watched = 0;
+    }
+}
+
+static void async_start(async_request * req);
+
+// Ends a request: its connection is kept for later requests if the server
+// allows, the next waiting request takes its slot, and the callback is
+// queued for the next response_poll()
+static void async_finish(async_request * req, char * result) {
+    async_unwatch(req);
+    if (result != NULL && req->parser.keep_alive && idle_count < ASYNC_IDLE_SIZE) {
+        idle[idle_count++] = req->conn;
+    } else {
+        close_connection(&req->conn);
+    }
+    free(req->out.data);
+    free(req->buf.data);
+    req->out.data = NULL;
+    req->message = NULL;
+    req->buf.data = NULL;
+    req->result = result;
+    list_push(&finished, req);
+
+    inflight--;
+    async_request * next = list_pop(&waiting);
+    if (next != NULL) {
+        async_start(next);
+    }
+}
+
+// Opens a fresh non-blocking connection for the request
+static int async_connect(async_request * req) {
+    req->conn.fd = open_socket(api_url, api_port, 1);
+    req->conn.ssl = NULL;
+    req->reused = 0;
+    req->state = REQ_CONNECTING;
+    if (req->conn.fd < 0) {
+        fprintf(stderr, "Failed to create socket\n");
+        return -1;
+    }
+    return async_watch(req, EPOLLOUT);
+}
+
+// Same retry rule as response(): a kept-alive connection the server closed
+// while idle fails before any byte arrives, so try once more on a fresh one
+static void async_fail(async_request * req) {
+    async_unwatch(req);
+    close_connection(&req->conn);
+    if (req->reused && req->buf.len == 0 && !req->retried) {
+        req->retried = 1;
+        req->sent = 0;
+        if (async_connect(req) == 0) {
+            return;
+        }
+    }
+    fprintf(stderr, "Failed to receive response\n");
+    async_finish(req, NULL);
+}
+
+// Waits for whatever the last SSL call asked for
+static void async_want(async_request * req, int ret) {
+    int error = SSL_get_error(req->conn.ssl, ret);
+    if (error == SSL_ERROR_WANT_READ) {
+        if (async_watch(req, EPOLLIN) < 0) {
+            async_fail(req);
+        }
+    } else if (error == SSL_ERROR_WANT_WRITE) {
+        if (async_watch(req, EPOLLOUT) < 0) {
+            async_fail(req);
+        }
+    } else {
+        async_fail(req);
+    }
+}
+
+// Advances a request as far as it can go without blocking
+static void async_step(async_request * req) {
+    int ret;
+
+    for (;;) {
+        switch (req->state) {
+        case REQ_CONNECTING: {
+            int error = 0;
+            socklen_t size = sizeof(error);
+            if (getsockopt(req->conn.fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0 || error != 0 ||
+                setup_tls(&req->conn) < 0) {
+                async_fail(req);
+                return;
+            }
+            req->state = REQ_HANDSHAKE;
+            break;
+        }
+        case REQ_HANDSHAKE:
+            ret = SSL_connect(req->conn.ssl);
+            if (ret <= 0) {
+                async_want(req, ret);
+                return;
+            }
+            req->state = REQ_SENDING;
+            break;
+        case REQ_SENDING:
+            while (req->sent < req->length) {
+                size_t left = req->length - req->sent;
+                ret = SSL_write(req->conn.ssl, req->message + req->sent, left > INT_MAX ? INT_MAX : (int) left);
+                if (ret <= 0) {
+                    async_want(req, ret);
+                    return;
+                }
+                req->sent += ret;
+            }
+            http_parser_init(&req->parser);
+            req->state = REQ_RECEIVING;
+            break;
+        case REQ_RECEIVING:
+            for (;;) {
+                int bytes = read_more(req->conn.ssl, &req->buf);
+                if (bytes == IO_WANT_READ || bytes == IO_WANT_WRITE) {
+                    if (async_watch(req, bytes == IO_WANT_READ ? EPOLLIN : EPOLLOUT) < 0) {
+                        async_fail(req);
+                    }
+                    return;
+                }
+                int parsed = bytes < 0 ? -1 : http_parse(&req->parser, &req->buf, bytes == 0);
+                if (parsed < 0) {
+                    async_fail(req);
+                    return;
+                }
+                if (parsed > 0) {
+                    remember_session(req->conn.ssl);
+                    char * result = strndup(req->buf.data + req->parser.body_start, req->parser.body_len);
+                    if (result == NULL) {
+                        fprintf(stderr, "Failed to parse response\n");
+                    } else if (cache_enabled && req->parser.status == 200) {
+                        cache_store(req->key, result, req->parser.body_len);
+                    }
+                    async_finish(req, result);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Puts a request on a kept-alive connection, or starts a new one
+static void async_start(async_request * req) {
+    inflight++;
+    if (idle_count > 0) {
+        req->conn = idle[--idle_count];
+        req->reused = 1;
+        req->state = REQ_SENDING;
+        async_step(req);
+        return;
+    }
+    if (async_connect(req) < 0) {
+        close_connection(&req->conn);
+        async_finish(req, NULL);
+    }
+}
+
+// Sets how many asynchronous requests may be on the wire at once.
+// More are queued and started as earlier ones finish.
+void response_set_max_inflight(int limit) {
+    max_inflight = limit > 0 ? limit : 1;
+}
+
+// Starts a request for the prompt and returns at once. The callback runs
+// from response_poll() with the response (owned by the callback, NULL if
+// anything went wrong) and ctx. Returns 0, or -1 if the request could not
+// be started, in which case the callback is never called.
+int response_async(const char * prompt, response_callback callback, void * ctx) {
+    if (!initialized) {
+        fprintf(stderr, "Not initialized\n");
+        return -1;
+    }
+
+    async_request * req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+        fprintf(stderr, "Failed to allocate request\n");
+        return -1;
+    }
+    req->callback = callback;
+    req->ctx = ctx;
+    req->conn.fd = -1;
+
+    if (api_key == NULL) {
+        req->result = fake_response();
+        list_push(&finished, req);
+        return 0;
+    }
+    if (tls_ctx == NULL) {
+        fprintf(stderr, "Failed to create SSL context\n");
+        free(req);
+        return -1;
+    }
+    if (epoll_fd < 0 && (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1 failed");
+        free(req);
+        return -1;
+    }
+
+    req->message = build_request(&req->out, prompt, &req->length, req->key);
+    if (cache_enabled && (req->result = cache_lookup(req->key)) != NULL) {
+        free(req->out.data);
+        req->out.data = NULL;
+        req->message = NULL;
+        list_push(&finished, req);
+        return 0;
+    }
+    if (inflight < max_inflight) {
+        async_start(req);
+    } else {
+        list_push(&waiting, req);
+    }
+    return 0;
+}
+
+// Number of asynchronous requests whose callback has not run yet
+int response_pending() {
+    int pending = inflight;
+    for (async_request * req = waiting.head; req != NULL; req = req->next) {
+        pending++;
+    }
+    for (async_request * req = finished.head; req != NULL; req = req->next) {
+        pending++;
+    }
+    return pending;
+}
+
+// Runs the event loop once, waiting up to timeout_ms (-1 forever) for
+// progress, then calls the callbacks of the requests that finished.
+// Returns how many callbacks ran.
+int response_poll(int timeout_ms) {
+    if (finished.head == NULL && inflight > 0) {
+        struct epoll_event events[ASYNC_EVENTS];
+        int count = epoll_wait(epoll_fd, events, ASYNC_EVENTS, timeout_ms);
+        for (int i = 0; i < count; i++) {
+            async_step(events[i].data.ptr);
+        }
+    }
+
+    int done = 0;
+    async_request * req;
+    while ((req = list_pop(&finished)) != NULL) {
+        if (req->callback != NULL) {
+            req->callback(req->result, req->ctx);
+        } else {
+            free(req->result);
+        }
+        free(req);
+        done++;
+    }
+    return done;
+}
+
+// Runs the event loop until every asynchronous request has completed
+void response_wait_all() {
+    while (response_pending() > 0) {
+        response_poll(-1);
+    }
+}
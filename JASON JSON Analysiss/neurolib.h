@@ -1,6 +1,8 @@
 #ifndef NEUROLIB_H
 #define NEUROLIB_H
 
+#include <stddef.h>
+
 // Initializes the neurosymbolic library. This function
 // must be called *exactly once* before calling any other
 // function in the library.
@@ -11,4 +13,77 @@ void neurosym_init();
 // If anything goes wrong, returns NULL.
 char * response(const char * prompt);
 
+// Same as response(), but returns the body without copying it: the string
+// lies in a receive buffer owned by the calling thread and stays valid
+// until that thread's next request. *len is set to its length.
+// Do not free it. If anything goes wrong, returns NULL.
+const char * response_body(const char * prompt, size_t * len);
+
+// Called with each piece of a streamed reply as it arrives (UTF-8 text,
+// not NUL-terminated, valid only during the call) and the caller's ctx.
+typedef void (*token_callback)(const char * token, size_t len, void * ctx);
+
+// Sends a prompt and asks for the reply as a stream: on_token is called
+// for every piece of text as soon as it arrives. Returns the whole reply,
+// which the caller must free, or NULL if anything goes wrong.
+char * response_stream(const char * prompt, token_callback on_token, void * ctx);
+
+// A multi-turn conversation: every request sends all turns so far.
+// Turns are serialized once, when added.
+typedef struct conversation conversation;
+
+// Starts an empty conversation, NULL if it cannot be allocated.
+conversation * conversation_new();
+
+// Adds a turn, role being "user", "assistant" or "system".
+void conversation_add(conversation * chat, const char * role, const char * content);
+
+// Removes the turn added last, e.g. a question whose request failed.
+// Only one turn can be removed; does nothing if there is none.
+void conversation_drop_last(conversation * chat);
+
+// Sends the conversation and returns the response body, like response_body().
+// The reply is not added to the conversation; add it with conversation_add().
+const char * conversation_response(conversation * chat, size_t * len);
+
+// Sends the conversation and streams the reply, like response_stream().
+char * conversation_stream(conversation * chat, token_callback on_token, void * ctx);
+
+// Frees the conversation.
+void conversation_free(conversation * chat);
+
+// Called with the response of an asynchronous request (NULL if anything
+// went wrong) and the ctx given to response_async(). The callback owns
+// the response and must free it.
+typedef void (*response_callback)(char * response, void * ctx);
+
+// Starts a request and returns without waiting for it. The callback runs
+// from response_poll() or response_wait_all(), on the calling thread.
+// Returns 0, or -1 if the request could not be started.
+int response_async(const char * prompt, response_callback callback, void * ctx);
+
+// Waits up to timeout_ms (-1 forever) for requests to make progress and
+// runs the callbacks of those that finished. Returns how many ran.
+int response_poll(int timeout_ms);
+
+// Runs callbacks until no asynchronous request is left.
+void response_wait_all();
+
+// Number of asynchronous requests whose callback has not run yet.
+int response_pending();
+
+// Maximum number of asynchronous requests on the wire at once (default 16).
+// Requests over the limit are queued.
+void response_set_max_inflight(int limit);
+
+// Turns on the response cache. Responses are keyed by the request body
+// (prompt, model and max_tokens) and kept for ttl_seconds, in memory and,
+// unless dir is NULL, as files in dir. max_bytes bounds each of the two.
+// 0 selects the defaults (one day, 64 MB). Returns 0, or -1 on failure.
+// Setting NEUROLIB_CACHE_DIR (and NEUROLIB_CACHE_TTL) enables it at init.
+int response_cache_enable(const char * dir, int ttl_seconds, size_t max_bytes);
+
+// Number of requests answered from the cache, and of those that were not.
+void response_cache_stats(unsigned long * hits, unsigned long * misses);
+
 #endif
@@ -1,80 +1,1679 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #define DEFAULT_window 50
+#define READ_CHUNK (1 << 20)    // bytes per read(), the file is never loaded whole
+#define MAX_TOKEN 512           // numbers up to this long are copied for strtod on the stack
+#define RING_START 4096         // first allocation of the window, it grows up to window_size
+
+// Reads the numbers of a file a large chunk at a time
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;     // bytes in buf
+    size_t pos;     // next unparsed byte
+    int eof;
+} reader;
+
+// The last window_size values seen, the oldest one at head once it is full
+typedef struct {
+    double *values;
+    int size;       // the window
+    int cap;        // allocated slots, up to size
+    int count;      // values held, up to size
+    int head;       // next slot to overwrite
+} ring;
+
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Anything the fast path doesn't handle (long mantissas, big exponents,
+// inf, nan, hex) goes through strtod, which is what fscanf used
+static const char *parse_number_slow(const char *s, const char *end, double *out) {
+    // strtod needs a terminated string, and the input (a mapping) may not be
+    // one: copy the whole word, whatever its length
+    size_t len = 0;
+    while (s + len < end && !is_space(s[len])) {
+        len++;
+    }
+    char small[MAX_TOKEN];
+    char *token = len < sizeof(small) ? small : malloc(len + 1);
+    if (token == NULL) {
+        return NULL;
+    }
+    memcpy(token, s, len);
+    token[len] = '\0';
+
+    char *stop;
+    *out = strtod(token, &stop);
+    if (stop == token) {
+        if (token != small) {
+            free(token);
+        }
+        return NULL;
+    }
+
+    // Match what fscanf consumed: it swallows a dangling exponent ("1e",
+    // "0x1p+") with the number and doesn't take the "(...)" of "nan(...)"
+    int hex = strchr(token, 'x') != NULL || strchr(token, 'X') != NULL;
+    if (*stop == 'e' || *stop == 'E' || (hex && (*stop == 'p' || *stop == 'P'))) {
+        stop++;
+        if (*stop == '+' || *stop == '-') {
+            stop++;
+        }
+    }
+    char *paren = strchr(token, '(');
+    if (paren != NULL && paren < stop) {
+        stop = paren;
+    }
+    const char *next = s + (stop - token);
+    if (token != small) {
+        free(token);
+    }
+    return next;
+}
+
+// Parses the number at s, returns the end of it or NULL if there is none.
+// Up to 19 significant digits with a power of ten up to 22 the result is
+// exact (mantissa and power are both exact doubles), so it matches strtod.
+static const char *parse_number(const char *s, const char *end, double *out) {
+    const char *p = s;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        mantissa = mantissa * 10 + (*p - '0');
+        significant += mantissa != 0;
+        digits++;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant += mantissa != 0;
+            exponent--;
+            digits++;
+            p++;
+        }
+    }
+    if (digits == 0 || significant > 19) {
+        return parse_number_slow(s, end, out);
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        int exp_negative = 0;
+        int value = 0;
+        if (e < end && (*e == '-' || *e == '+')) {
+            exp_negative = *e == '-';
+            e++;
+        }
+        if (e >= end || *e < '0' || *e > '9') {
+            return parse_number_slow(s, end, out);
+        }
+        while (e < end && *e >= '0' && *e <= '9' && value < 10000) {
+            value = value * 10 + (*e - '0');
+            e++;
+        }
+        exponent += exp_negative ? -value : value;
+        p = e;
+    }
+
+    // a number glued to something else (hex, "1.5.3", digits after a huge exponent)
+    if (p < end && !is_space(*p)) {
+        return parse_number_slow(s, end, out);
+    }
+    if (mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) {
+        return parse_number_slow(s, end, out);
+    }
+
+    double value = (double) mantissa;
+    value = exponent < 0 ? value / pow10_table[-exponent] : value * pow10_table[exponent];
+    *out = negative ? -value : value;
+    return p;
+}
+
+// Moves the unparsed tail to the front and reads more after it
+static int reader_fill(reader *r) {
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+
+    while (r->len < READ_CHUNK) {
+        ssize_t n = read(r->fd, r->buf + r->len, READ_CHUNK - r->len);
+        if (n < 0) {
+            perror("Error reading file");
+            return -1;
+        }
+        if (n == 0) {
+            r->eof = 1;
+            break;
+        }
+        r->len += n;
+    }
+    return 0;
+}
+
+// Reads the next number. Returns 1, or 0 at the end of the file or at the
+// first thing that isn't a number, like the fscanf loop it replaces.
+static int reader_next(reader *r, double *value) {
+    for (;;) {
+        while (r->pos < r->len && is_space(r->buf[r->pos])) {
+            r->pos++;
+        }
+
+        // near the end of the buffer, read more first so no number is cut in two
+        if (r->len - r->pos < MAX_TOKEN && !r->eof) {
+            if (reader_fill(r) < 0) {
+                return 0;
+            }
+            continue;
+        }
+        if (r->pos == r->len) {
+            return 0;
+        }
+
+        const char *stop = parse_number(r->buf + r->pos, r->buf + r->len, value);
+        if (stop == NULL) {
+            return 0;
+        }
+
+        // a word longer than MAX_TOKEN may still go on past the buffer: read
+        // the rest and parse it again, or give up if it fills the whole buffer
+        const char *word_end = stop;
+        while (word_end < r->buf + r->len && !is_space(*word_end)) {
+            word_end++;
+        }
+        if (word_end == r->buf + r->len && !r->eof) {
+            if (r->pos == 0 && r->len == READ_CHUNK) {
+                return 0;
+            }
+            if (reader_fill(r) < 0) {
+                return 0;
+            }
+            continue;
+        }
+
+        r->pos = stop - r->buf;
+        return 1;
+    }
+}
+
+// ---- Input sources ----
+//
+// A regular file is mapped and parsed by several threads at once: each
+// segment of the file is cut into one chunk per thread at whitespace, the
+// chunks are parsed in parallel into their own arrays, and the arrays are
+// handed out in file order. Pipes and other unmappable input are streamed
+// with the reader. Either way values come out in batches and only one
+// segment is held in memory.
+
+#define CHUNK_BYTES (4 << 20)   // bytes parsed by one thread per segment
+#define BATCH 4096              // values per batch when streaming
+#define MAX_THREADS 256
+
+// One thread's part of a segment
+typedef struct {
+    const char *start;
+    const char *end;
+    double *values;
+    size_t count;
+    size_t cap;
+    int failed;     // stopped at something that isn't a number
+} chunk;
+
+typedef struct {
+    // streamed input
+    int fd;
+    reader in;
+    double *batch;
+
+    // mapped input
+    const char *map;
+    size_t size;
+    size_t offset;      // start of the next segment
+    int threads;
+    chunk *chunks;
+    int nchunks;        // chunks in the current segment
+    int next;           // next chunk to hand out
+    int stopped;        // a chunk failed, nothing after it counts
+} source;
+
+// Parses the numbers of a chunk, like reader_next() does for a stream
+static void *parse_chunk(void *arg) {
+    chunk *c = arg;
+    const char *p = c->start;
+    c->count = 0;
+    c->failed = 0;
+
+    for (;;) {
+        while (p < c->end && is_space(*p)) {
+            p++;
+        }
+        if (p == c->end) {
+            break;
+        }
+        if (c->count == c->cap) {
+            size_t cap = c->cap ? c->cap * 2 : (size_t) (c->end - c->start) / 8 + 16;
+            double *grown = realloc(c->values, cap * sizeof(double));
+            if (!grown) {
+                c->failed = 1;
+                break;
+            }
+            c->values = grown;
+            c->cap = cap;
+        }
+        p = parse_number(p, c->end, &c->values[c->count]);
+        if (p == NULL) {
+            c->failed = 1;
+            break;
+        }
+        c->count++;
+    }
+    return NULL;
+}
+
+// Cuts the next segment into chunks at whitespace and parses them in parallel
+static void parse_segment(source *src) {
+    pthread_t tids[src->threads];
+    size_t pos = src->offset;
+    int n = 0;
+
+    while (n < src->threads && pos < src->size) {
+        size_t end = pos + CHUNK_BYTES < src->size ? pos + CHUNK_BYTES : src->size;
+        while (end < src->size && !is_space(src->map[end])) {
+            end++;
+        }
+        src->chunks[n].start = src->map + pos;
+        src->chunks[n].end = src->map + end;
+        pos = end;
+        n++;
+    }
+
+    // have the kernel read the following segment while this one is parsed
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t ahead = pos & ~(page - 1);
+    if (ahead < src->size) {
+        size_t len = (size_t) src->threads * CHUNK_BYTES;
+        madvise((void *) (src->map + ahead), ahead + len < src->size ? len : src->size - ahead, MADV_WILLNEED);
+    }
+
+    int started = 0;
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&tids[i], NULL, parse_chunk, &src->chunks[i]) != 0) {
+            break;
+        }
+        started = i;
+    }
+    // the calling thread parses the first chunk, and any a thread couldn't take
+    parse_chunk(&src->chunks[0]);
+    for (int i = started + 1; i < n; i++) {
+        parse_chunk(&src->chunks[i]);
+    }
+    for (int i = 1; i <= started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    src->offset = pos;
+    src->nchunks = n;
+    src->next = 0;
+}
+
+static int source_open(source *src, const char *filename, int threads) {
+    memset(src, 0, sizeof(*src));
+    src->fd = open(filename, O_RDONLY);
+    if (src->fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            src->map = map;
+            src->size = st.st_size;
+            src->threads = threads;
+            src->chunks = calloc(threads, sizeof(chunk));
+            return src->chunks ? 0 : -1;
+        }
+    }
+
+    posix_fadvise(src->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    src->in.fd = src->fd;
+    src->in.buf = malloc(READ_CHUNK);
+    src->batch = malloc(BATCH * sizeof(double));
+    return src->in.buf && src->batch ? 0 : -1;
+}
+
+// Hands out the next batch of values in file order, returns how many (0 at the end)
+static size_t source_next(source *src, const double **values) {
+    if (src->map == NULL) {
+        size_t n = 0;
+        while (n < BATCH && reader_next(&src->in, &src->batch[n])) {
+            n++;
+        }
+        *values = src->batch;
+        return n;
+    }
+
+    for (;;) {
+        if (src->next < src->nchunks) {
+            chunk *c = &src->chunks[src->next++];
+            if (c->failed) {
+                src->stopped = 1;
+                src->nchunks = 0;
+            }
+            if (c->count > 0) {
+                *values = c->values;
+                return c->count;
+            }
+            continue;
+        }
+        if (src->stopped || src->offset >= src->size) {
+            return 0;
+        }
+        parse_segment(src);
+    }
+}
+
+static void source_close(source *src) {
+    if (src->map != NULL) {
+        munmap((void *) src->map, src->size);
+        for (int i = 0; i < src->threads; i++) {
+            free(src->chunks[i].values);
+        }
+        free(src->chunks);
+    }
+    free(src->in.buf);
+    free(src->batch);
+    if (src->fd >= 0) {
+        close(src->fd);
+    }
+}
+
+// Parses one word forwards, the way the full read does: "1.5.3" is 1.5 and
+// .3. The last of its numbers go to values[..k], as many as fit. Returns
+// how many numbers the word holds, or -1 if part of it isn't a number.
+static int tail_word(const char *start, const char *end, double *values, int k) {
+    int n = 0;
+    double value;
+    for (const char *p = start; p < end; n++) {
+        p = parse_number(p, end, &value);
+        if (p == NULL) {
+            return -1;
+        }
+    }
+
+    const char *p = start;
+    for (int i = 0; i < n; i++) {
+        p = parse_number(p, end, &value);
+        if (n - 1 - i <= k) {
+            values[k - (n - 1 - i)] = value;
+        }
+    }
+    return n;
+}
+
+// --tail: reads only the last window_size numbers, scanning backwards from
+// the end of the file, so the cost doesn't depend on the file size. The
+// file is trusted to hold nothing but numbers (the full read would stop at
+// the first word that isn't one). Returns 0, or -1 with a message.
+static int tail_window(const source *src, double *values, int window_size) {
+    size_t end = src->size;
+    int k = window_size - 1;
+    while (k >= 0) {
+        while (end > 0 && is_space(src->map[end - 1])) {
+            end--;
+        }
+        if (end == 0) {
+            fprintf(stderr, "window too large!\n");
+            return -1;
+        }
+        size_t start = end;
+        while (start > 0 && !is_space(src->map[start - 1])) {
+            start--;
+        }
+        int n = tail_word(src->map + start, src->map + end, values, k);
+        if (n < 0) {
+            fprintf(stderr, "Not a number near the end of the file: %.*s\n", (int) (end - start), src->map + start);
+            return -1;
+        }
+        k -= n;
+        end = start;
+    }
+    return 0;
+}
+
+static int ring_push(ring *w, double value) {
+    if (w->count < w->size) {
+        if (w->count == w->cap) {
+            int cap = w->cap * 2 < w->size ? w->cap * 2 : w->size;
+            double *grown = realloc(w->values, cap * sizeof(double));
+            if (!grown) {
+                return -1;
+            }
+            w->values = grown;
+            w->cap = cap;
+        }
+        w->values[w->count++] = value;
+        w->head = w->count % w->size;
+        return 0;
+    }
+    w->values[w->head] = value;
+    w->head = (w->head + 1) % w->size;
+    return 0;
+}
+
+// ---- Rolling series (--series) ----
+
+#define OUT_BUFFER (1 << 16)
+
+// Indicators of --series, printed as columns in the order asked for
+enum { SMA, EMA, WMA, MIN, MAX, STD, KINDS };
+static const char *kind_names[KINDS] = {"sma", "ema", "wma", "min", "max", "std"};
+
+// Output collected in a large buffer and written with few write() calls
+typedef struct {
+    char buf[OUT_BUFFER];
+    size_t len;
+} writer;
+
+static void out_flush(writer *out) {
+    fwrite(out->buf, 1, out->len, stdout);
+    out->len = 0;
+}
+
+// Writes a value as "%.2f" would. When value * 100 isn't close to a
+// rounding tie the digits can be worked out directly; ties, huge values,
+// inf and nan go through snprintf for the exact printf rounding.
+static void out_fixed2(writer *out, double value) {
+    if (out->len > OUT_BUFFER - 400) {
+        out_flush(out);
+    }
+    char *p = out->buf + out->len;
+
+    double scaled = value * 100;
+    double magnitude = scaled < 0 ? -scaled : scaled;
+    double frac = magnitude - (double) (long long) magnitude;
+    if (!(magnitude < 1e15) || (frac > 0.5 - 1e-6 && frac < 0.5 + 1e-6)) {
+        out->len += snprintf(p, 400, "%.2f", value);
+        return;
+    }
+
+    unsigned long long cents = (unsigned long long) (magnitude + 0.5);
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = '0' + cents % 10;
+        cents /= 10;
+    } while (cents > 0 || n < 3);
+
+    if (signbit(value)) {
+        *p++ = '-';
+    }
+    while (n > 2) {
+        *p++ = digits[--n];
+    }
+    *p++ = '.';
+    *p++ = digits[1];
+    *p++ = digits[0];
+    out->len = p - out->buf;
+}
+
+static void out_char(writer *out, char c) {
+    if (out->len == OUT_BUFFER) {
+        out_flush(out);
+    }
+    out->buf[out->len++] = c;
+}
+
+// Indices of the window values in a monotonic order, so the front is the
+// window's min (or max) and each value enters and leaves once
+typedef struct {
+    long *idx;
+    int cap;
+    int head;
+    int count;
+} deque;
+
+static long deque_front(const deque *q) {
+    return q->idx[q->head];
+}
+
+static long deque_back(const deque *q) {
+    return q->idx[(q->head + q->count - 1) % q->cap];
+}
+
+// Adds index i, dropping the values it makes irrelevant and the one that left the window
+static void deque_push(deque *q, const ring *w, long i, int keep_max) {
+    double x = w->values[i % w->size];
+    while (q->count > 0) {
+        double back = w->values[deque_back(q) % w->size];
+        if (keep_max ? back > x : back < x) {
+            break;
+        }
+        q->count--;
+    }
+    q->idx[(q->head + q->count) % q->cap] = i;
+    q->count++;
+    if (deque_front(q) <= i - w->size) {
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+    }
+}
+
+// Adds with Kahan compensation
+static void kahan_add(double *sum, double *carry, double x) {
+    double y = x - *carry;
+    double t = *sum + y;
+    *carry = (t - *sum) - y;
+    *sum = t;
+}
+
+// Rolling state of every indicator
+typedef struct {
+    ring values;
+    deque mins, maxs;
+    long n;             // values seen
+    double sum;         // of the window
+    double weighted;    // sum of k * x_k, the newest value weighted window_size
+    double mean, m2;    // Welford
+    double ema, alpha;
+} rolling;
+
+// The running sums pick up rounding error with every add and subtract; they
+// are recomputed from the window, with compensated sums, once per window
+static void rolling_resync(rolling *r) {
+    int size = r->values.size;
+    double sum = 0, sum_c = 0, weighted = 0, weighted_c = 0;
+    for (int k = 0; k < size; k++) {
+        double x = r->values.values[(r->n - size + k) % size];
+        kahan_add(&sum, &sum_c, x);
+        kahan_add(&weighted, &weighted_c, (double) (k + 1) * x);
+    }
+    double mean = sum / size, m2 = 0, m2_c = 0;
+    for (int k = 0; k < size; k++) {
+        double d = r->values.values[(r->n - size + k) % size] - mean;
+        kahan_add(&m2, &m2_c, d * d);
+    }
+    r->sum = sum;
+    r->weighted = weighted;
+    r->mean = mean;
+    r->m2 = m2;
+}
+
+static int rolling_push(rolling *r, double x) {
+    int size = r->values.size;
+    double old = r->n >= size ? r->values.values[r->n % size] : 0;
+    if (ring_push(&r->values, x) < 0) {
+        return -1;
+    }
+
+    if (r->n < size) {
+        r->weighted += (double) (r->n + 1) * x;
+        r->sum += x;
+        double delta = x - r->mean;
+        r->mean += delta / (r->n + 1);
+        r->m2 += delta * (x - r->mean);
+    } else {
+        // every weight drops by one, the new value comes in at the top
+        r->weighted += size * x - r->sum;
+        r->sum += x - old;
+        double delta = x - old;
+        double old_mean = r->mean;
+        r->mean += delta / size;
+        r->m2 += delta * (x - r->mean + old - old_mean);
+    }
+
+    deque_push(&r->mins, &r->values, r->n, 0);
+    deque_push(&r->maxs, &r->values, r->n, 1);
+    r->n++;
+
+    if (r->n > size && r->n % size == 0) {
+        rolling_resync(r);
+    }
+    if (r->n == size) {
+        r->ema = r->sum / size;     // seeded with the first full window's average
+    } else if (r->n > size) {
+        r->ema += r->alpha * (x - r->ema);
+    }
+    return 0;
+}
+
+static double rolling_value(const rolling *r, int kind) {
+    int size = r->values.size;
+    switch (kind) {
+    case SMA: return r->sum / size;
+    case EMA: return r->ema;
+    case WMA: return r->weighted / ((double) size * (size + 1) / 2);
+    case MIN: return r->values.values[deque_front(&r->mins) % size];
+    case MAX: return r->values.values[deque_front(&r->maxs) % size];
+    default: return sqrt(r->m2 > 0 ? r->m2 / size : 0);
+    }
+}
+
+// Parses a comma-separated list of indicator names, returns how many or -1
+static int parse_kinds(const char *list, int *kinds) {
+    int count = 0;
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+        int found = -1;
+        for (int k = 0; k < KINDS; k++) {
+            if (strlen(kind_names[k]) == len && strncmp(list, kind_names[k], len) == 0) {
+                found = k;
+            }
+        }
+        if (found < 0 || count == KINDS) {
+            return -1;
+        }
+        kinds[count++] = found;
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
+    return count;
+}
+
+static int rolling_init(rolling *r, int window_size) {
+    memset(r, 0, sizeof(*r));
+    r->values.size = window_size;
+    r->values.cap = window_size;
+    r->values.values = malloc(window_size * sizeof(double));
+    // a push briefly holds one index more than the window, before the oldest leaves
+    r->mins.idx = malloc((window_size + 1) * sizeof(long));
+    r->maxs.idx = malloc((window_size + 1) * sizeof(long));
+    r->mins.cap = r->maxs.cap = window_size + 1;
+    r->alpha = 2.0 / (window_size + 1);
+    return r->values.values && r->mins.idx && r->maxs.idx ? 0 : -1;
+}
+
+static void rolling_free(rolling *r) {
+    free(r->values.values);
+    free(r->mins.idx);
+    free(r->maxs.idx);
+}
+
+// One line of --series, the indicators in the order asked for
+static void rolling_print(const rolling *r, writer *out, const int *kinds, int nkinds) {
+    for (int k = 0; k < nkinds; k++) {
+        if (k > 0) {
+            out_char(out, ' ');
+        }
+        out_fixed2(out, rolling_value(r, kinds[k]));
+    }
+    out_char(out, '\n');
+}
+
+// Prints one line per value once the window is full, all indicators in one pass
+static int run_series(source *src, int window_size, const int *kinds, int nkinds) {
+    rolling r;
+    writer *out = malloc(sizeof(writer));
+
+    int status = 0;
+    if (rolling_init(&r, window_size) < 0 || !out) {
+        fprintf(stderr, "Memory allocation failed\n");
+        status = 1;
+    } else {
+        out->len = 0;
+        const double *values;
+        size_t count;
+        while (status == 0 && (count = source_next(src, &values)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                if (rolling_push(&r, values[i]) < 0) {
+                    fprintf(stderr, "Memory allocation failed\n");
+                    status = 1;
+                    break;
+                }
+                if (r.n >= window_size) {
+                    rolling_print(&r, out, kinds, nkinds);
+                }
+            }
+        }
+        out_flush(out);
+        if (status == 0 && r.n < window_size) {
+            fprintf(stderr, "window too large!\n");
+            status = 1;
+        }
+    }
+
+    rolling_free(&r);
+    free(out);
+    return status;
+}
+
+// ---- CSV columns (--columns) ----
+//
+// Each selected column keeps its own contiguous buffer: the last window
+// values, then the rows of the current block. The value leaving the window
+// for block row r is then col[r] and the one entering is col[window + r],
+// so the window sums of many columns are updated from plain contiguous
+// loads, several series per instruction where AVX2 is available.
+
+#define BLOCK_ROWS 1024         // rows parsed before the window sums are updated
+
+typedef struct {
+    int window;
+    int ncols;          // selected columns, in output order
+    int *field;         // 0-based CSV field of each selected column
+    int nslots;
+    int *slot;          // selected column of each field, -1 if not selected
+    int rows;           // rows per block
+    double **cols;      // per column: the last window values, then the block
+    double **sums;      // per column: window sum after each block row (--series)
+    double *state;      // running window sum of each column
+    long n;             // rows before the current block
+} table;
+
+// Window sums of rows [from, to) of a block: sum += entering - leaving, like rolling_push()
+typedef void sums_kernel(double **cols, double **sums, double *state, int ncols, int window, int from, int to);
+
+static void sums_scalar(double **cols, double **sums, double *state, int ncols, int window, int from, int to) {
+    for (int c = 0; c < ncols; c++) {
+        const double *x = cols[c];
+        double *out = sums[c];
+        double s = state[c];
+        for (int r = from; r < to; r++) {
+            s += x[window + r] - x[r];
+            out[r] = s;
+        }
+        state[c] = s;
+    }
+}
+
+#ifdef __x86_64__
+// Rows r..r+3 of four columns: the rows are loaded and subtracted along
+// time, transposed so each vector holds one row of the four columns,
+// accumulated, and transposed back
+__attribute__((target("avx2")))
+static inline __m256d sums4x4(double **x, double **o, __m256d s, int window, int r) {
+    __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(x[0] + window + r), _mm256_loadu_pd(x[0] + r));
+    __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(x[1] + window + r), _mm256_loadu_pd(x[1] + r));
+    __m256d d2 = _mm256_sub_pd(_mm256_loadu_pd(x[2] + window + r), _mm256_loadu_pd(x[2] + r));
+    __m256d d3 = _mm256_sub_pd(_mm256_loadu_pd(x[3] + window + r), _mm256_loadu_pd(x[3] + r));
+
+    __m256d t0 = _mm256_unpacklo_pd(d0, d1);
+    __m256d t1 = _mm256_unpackhi_pd(d0, d1);
+    __m256d t2 = _mm256_unpacklo_pd(d2, d3);
+    __m256d t3 = _mm256_unpackhi_pd(d2, d3);
+
+    __m256d s0 = _mm256_add_pd(s, _mm256_permute2f128_pd(t0, t2, 0x20));
+    __m256d s1 = _mm256_add_pd(s0, _mm256_permute2f128_pd(t1, t3, 0x20));
+    __m256d s2 = _mm256_add_pd(s1, _mm256_permute2f128_pd(t0, t2, 0x31));
+    s = _mm256_add_pd(s2, _mm256_permute2f128_pd(t1, t3, 0x31));
+
+    t0 = _mm256_unpacklo_pd(s0, s1);
+    t1 = _mm256_unpackhi_pd(s0, s1);
+    t2 = _mm256_unpacklo_pd(s2, s);
+    t3 = _mm256_unpackhi_pd(s2, s);
+    _mm256_storeu_pd(o[0] + r, _mm256_permute2f128_pd(t0, t2, 0x20));
+    _mm256_storeu_pd(o[1] + r, _mm256_permute2f128_pd(t1, t3, 0x20));
+    _mm256_storeu_pd(o[2] + r, _mm256_permute2f128_pd(t0, t2, 0x31));
+    _mm256_storeu_pd(o[3] + r, _mm256_permute2f128_pd(t1, t3, 0x31));
+    return s;
+}
+
+// Eight columns at a time, as two independent chains of additions so one
+// can go on while the other waits for its result. The additions happen in
+// the same order as in sums_scalar(), so the results are identical.
+__attribute__((target("avx2")))
+static void sums_avx2(double **cols, double **sums, double *state, int ncols, int window, int from, int to) {
+    int c = 0;
+    for (; c + 8 <= ncols; c += 8) {
+        __m256d lo = _mm256_loadu_pd(state + c);
+        __m256d hi = _mm256_loadu_pd(state + c + 4);
+        int r = from;
+        for (; r + 4 <= to; r += 4) {
+            lo = sums4x4(cols + c, sums + c, lo, window, r);
+            hi = sums4x4(cols + c + 4, sums + c + 4, hi, window, r);
+        }
+        _mm256_storeu_pd(state + c, lo);
+        _mm256_storeu_pd(state + c + 4, hi);
+        // the last rows of the block one at a time
+        sums_scalar(cols + c, sums + c, state + c, 8, window, r, to);
+    }
+    for (; c + 4 <= ncols; c += 4) {
+        __m256d s = _mm256_loadu_pd(state + c);
+        int r = from;
+        for (; r + 4 <= to; r += 4) {
+            s = sums4x4(cols + c, sums + c, s, window, r);
+        }
+        _mm256_storeu_pd(state + c, s);
+        sums_scalar(cols + c, sums + c, state + c, 4, window, r, to);
+    }
+    sums_scalar(cols + c, sums + c, state + c, ncols - c, window, from, to);
+}
+#endif
+
+static sums_kernel *pick_kernel(void) {
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        return sums_avx2;
+    }
+#endif
+    return sums_scalar;
+}
+
+// Hands out the next line without its line ending. Returns 1, or 0 at the end of the input.
+static int reader_line(reader *r, const char **line, size_t *len) {
+    for (;;) {
+        char *start = r->buf + r->pos;
+        char *newline = memchr(start, '\n', r->len - r->pos);
+        // a line longer than the whole buffer comes out in pieces
+        if (newline == NULL && !r->eof && !(r->pos == 0 && r->len == READ_CHUNK)) {
+            if (reader_fill(r) < 0) {
+                return 0;
+            }
+            continue;
+        }
+        if (r->pos == r->len) {
+            return 0;
+        }
+        size_t n = newline ? (size_t) (newline - start) : r->len - r->pos;
+        r->pos += newline ? n + 1 : n;
+        if (n > 0 && start[n - 1] == '\r') {
+            n--;
+        }
+        *line = start;
+        *len = n;
+        return 1;
+    }
+}
+
+static int blank(const char *line, size_t len) {
+    while (len > 0 && is_space(line[len - 1])) {
+        len--;
+    }
+    return len == 0;
+}
+
+// Says whether the field [start, end) is one number, spaces around it aside
+static int field_number(const char *start, const char *end, double *value) {
+    while (start < end && is_space(*start)) {
+        start++;
+    }
+    if (start == end) {
+        return 0;
+    }
+    const char *stop = parse_number(start, end, value);
+    while (stop != NULL && stop < end && is_space(*stop)) {
+        stop++;
+    }
+    return stop == end;
+}
+
+// Parses the selected fields of a line into block row r. Returns 0, or the
+// 1-based field that is missing or not a number.
+static int table_row(table *t, const char *line, size_t len, int r) {
+    const char *p = line;
+    const char *end = line + len;
+    int f = 0;
+    int seen = 0;
+
+    while (f < t->nslots && seen < t->ncols) {
+        const char *comma = memchr(p, ',', end - p);
+        const char *stop = comma ? comma : end;
+        int c = t->slot[f];
+        if (c >= 0) {
+            if (!field_number(p, stop, &t->cols[c][t->window + r])) {
+                return f + 1;
+            }
+            seen++;
+        }
+        f++;
+        if (comma == NULL) {
+            break;
+        }
+        p = comma + 1;
+    }
+    if (seen < t->ncols) {
+        while (t->slot[f] < 0) {
+            f++;
+        }
+        return f + 1;
+    }
+    return 0;
+}
+
+// Updates the window sums over the first m rows of the block and prints
+// them, then keeps the last window values for the next block
+static void table_flush(table *t, int m, sums_kernel *kernel, writer *out) {
+    int window = t->window;
+
+    if (out != NULL) {
+        // cut at every multiple of the window, where rolling_push() resyncs
+        int r = 0;
+        while (r < m) {
+            long n = t->n + r;
+            int to = r + (window - (int) (n % window));
+            if (to > m) {
+                to = m;
+            }
+            kernel(t->cols, t->sums, t->state, t->ncols, window, r, to);
+            n = t->n + to;
+            if (n > window && n % window == 0) {
+                for (int c = 0; c < t->ncols; c++) {
+                    double sum = 0, carry = 0;
+                    for (int k = to; k < window + to; k++) {
+                        kahan_add(&sum, &carry, t->cols[c][k]);
+                    }
+                    t->state[c] = t->sums[c][to - 1] = sum;
+                }
+            }
+            r = to;
+        }
+
+        for (r = 0; r < m; r++) {
+            if (t->n + r + 1 < window) {
+                continue;
+            }
+            for (int c = 0; c < t->ncols; c++) {
+                if (c > 0) {
+                    out_char(out, ' ');
+                }
+                out_fixed2(out, t->sums[c][r] / window);
+            }
+            out_char(out, '\n');
+        }
+    }
+
+    for (int c = 0; c < t->ncols; c++) {
+        memmove(t->cols[c], t->cols[c] + m, window * sizeof(double));
+    }
+    t->n += m;
+}
+
+static int table_alloc(table *t, int with_sums) {
+    t->rows = t->window > BLOCK_ROWS ? t->window : BLOCK_ROWS;
+    t->cols = calloc(t->ncols, sizeof(double *));
+    t->sums = calloc(t->ncols, sizeof(double *));
+    t->state = calloc(t->ncols, sizeof(double));
+    if (!t->cols || !t->sums || !t->state) {
+        return -1;
+    }
+    for (int c = 0; c < t->ncols; c++) {
+        // zeros before the first value, so the window fills up through the same sums
+        t->cols[c] = calloc((size_t) t->window + t->rows, sizeof(double));
+        t->sums[c] = with_sums ? malloc(t->rows * sizeof(double)) : NULL;
+        if (!t->cols[c] || (with_sums && !t->sums[c])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void table_free(table *t) {
+    for (int c = 0; c < t->ncols; c++) {
+        if (t->cols) {
+            free(t->cols[c]);
+        }
+        if (t->sums) {
+            free(t->sums[c]);
+        }
+    }
+    free(t->cols);
+    free(t->sums);
+    free(t->state);
+    free(t->field);
+    free(t->slot);
+}
+
+// Resolves --columns against the first line: 1-based numbers or header
+// names, by default every column but the first (the timestamp). Sets
+// *header when the first line holds names rather than values.
+static int table_select(table *t, const char *list, const char *line, size_t len, int *header) {
+    int nfields = 1;
+    for (size_t i = 0; i < len; i++) {
+        nfields += line[i] == ',';
+    }
+
+    // field boundaries of the first line
+    const char *starts[nfields + 1];
+    starts[0] = line;
+    for (int f = 1, i = 0; f < nfields; i++) {
+        if (line[i] == ',') {
+            starts[f++] = line + i + 1;
+        }
+    }
+    starts[nfields] = line + len + 1;
+
+    int cap = nfields;
+    for (const char *p = list; p != NULL && *p != '\0'; p++) {
+        cap += *p == ',';
+    }
+    t->field = malloc(cap * sizeof(int));
+    if (!t->field) {
+        return -1;
+    }
+
+    int named = 0;
+    t->ncols = 0;
+    if (list == NULL) {
+        for (int f = 1; f < nfields; f++) {
+            t->field[t->ncols++] = f;
+        }
+    } else {
+        while (*list != '\0') {
+            size_t n = strcspn(list, ",");
+            char *stop;
+            long number = strtol(list, &stop, 10);
+            int f = -1;
+            if (stop == list + n && n > 0) {
+                f = number >= 1 && number <= nfields ? (int) number - 1 : -1;
+            } else {
+                named = 1;
+                for (int k = 0; k < nfields && f < 0; k++) {
+                    const char *s = starts[k];
+                    const char *e = starts[k + 1] - 1;
+                    while (s < e && is_space(*s)) {
+                        s++;
+                    }
+                    while (e > s && is_space(e[-1])) {
+                        e--;
+                    }
+                    if ((size_t) (e - s) == n && strncmp(s, list, n) == 0) {
+                        f = k;
+                    }
+                }
+            }
+            if (f < 0) {
+                fprintf(stderr, "No column %.*s\n", (int) n, list);
+                return -1;
+            }
+            t->field[t->ncols++] = f;
+            list += n;
+            if (*list == ',') {
+                list++;
+            }
+        }
+    }
+    if (t->ncols == 0) {
+        fprintf(stderr, "No columns to average\n");
+        return -1;
+    }
+
+    t->nslots = 0;
+    for (int c = 0; c < t->ncols; c++) {
+        if (t->field[c] + 1 > t->nslots) {
+            t->nslots = t->field[c] + 1;
+        }
+    }
+    t->slot = malloc(t->nslots * sizeof(int));
+    if (!t->slot) {
+        return -1;
+    }
+    for (int f = 0; f < t->nslots; f++) {
+        t->slot[f] = -1;
+    }
+    for (int c = 0; c < t->ncols; c++) {
+        if (t->slot[t->field[c]] >= 0) {
+            fprintf(stderr, "Column %d selected twice\n", t->field[c] + 1);
+            return -1;
+        }
+        t->slot[t->field[c]] = c;
+    }
+
+    // the first line is a header if a selected field of it isn't a number
+    *header = named;
+    for (int c = 0; c < t->ncols && !*header; c++) {
+        double value;
+        int f = t->field[c];
+        *header = !field_number(starts[f], starts[f + 1] - 1, &value);
+    }
+    return 0;
+}
+
+// Moving averages of several CSV columns at once: the last average of each
+// column on one line, or with --series one line of SMAs per row
+static int run_columns(const char *filename, int window_size, const char *list, int series) {
+    table t;
+    memset(&t, 0, sizeof(t));
+    t.window = window_size;
+
+    reader in = {open(filename, O_RDONLY), malloc(READ_CHUNK), 0, 0, 0};
+    writer *out = series ? malloc(sizeof(writer)) : NULL;
+    if (in.fd < 0) {
+        fprintf(stderr, "Error opening file\n");
+        free(in.buf);
+        free(out);
+        return 1;
+    }
+    posix_fadvise(in.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int status = 1;
+    const char *line;
+    size_t len;
+    int header;
+    if (!in.buf || (series && !out)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+    long line_number = 0;
+    do {
+        if (!reader_line(&in, &line, &len)) {
+            fprintf(stderr, "window too large!\n");
+            goto done;
+        }
+        line_number++;
+    } while (blank(line, len));
+    if (table_select(&t, list, line, len, &header) < 0) {
+        goto done;
+    }
+    if (table_alloc(&t, series) < 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+    if (series) {
+        out->len = 0;
+    }
+
+    sums_kernel *kernel = pick_kernel();
+    int r = 0;
+    int more = 1;
+    if (header) {
+        more = reader_line(&in, &line, &len);
+        line_number++;
+    }
+    while (more) {
+        if (!blank(line, len)) {
+            int bad = table_row(&t, line, len, r);
+            if (bad) {
+                // like the single column, what came before still counts
+                fprintf(stderr, "Not a number in line %ld, column %d\n", line_number, bad);
+                break;
+            }
+            if (++r == t.rows) {
+                table_flush(&t, r, kernel, out);
+                r = 0;
+            }
+        }
+        more = reader_line(&in, &line, &len);
+        line_number++;
+    }
+    table_flush(&t, r, kernel, out);
+    if (series) {
+        out_flush(out);
+    }
+
+    if (t.n < window_size) {
+        fprintf(stderr, "window too large!\n");
+        goto done;
+    }
+    if (!series) {
+        // the last window of each column, summed oldest first
+        for (int c = 0; c < t.ncols; c++) {
+            double sum = 0;
+            for (int k = 0; k < window_size; k++) {
+                sum += t.cols[c][k];
+            }
+            printf(c > 0 ? " %.2f" : "%.2f", sum / window_size);
+        }
+        printf("\n");
+    }
+    status = 0;
+
+done:
+    table_free(&t);
+    close(in.fd);
+    free(in.buf);
+    free(out);
+    return status;
+}
+
+// --bench: times the window sum kernels on random columns, generated a block
+// at a time so the table never has to fit in memory
+static int run_bench(long rows, int ncols, int window_size) {
+    table t;
+    memset(&t, 0, sizeof(t));
+    t.window = window_size;
+    t.ncols = ncols;
+    double *expected = malloc((size_t) ncols * sizeof(double));
+    // the scalar results, to compare with
+    table check;
+    memset(&check, 0, sizeof(check));
+    check.window = window_size;
+    check.ncols = ncols;
+    if (table_alloc(&t, 1) < 0 || table_alloc(&check, 1) < 0 || !expected) {
+        fprintf(stderr, "Memory allocation failed\n");
+        table_free(&t);
+        table_free(&check);
+        free(expected);
+        return 1;
+    }
+
+    sums_kernel *kernel = pick_kernel();
+    uint64_t seed = 88172645463325252ULL;
+    double scalar_ns = 0, kernel_ns = 0;
+    int mismatch = 0;
+
+    for (long done = 0; done < rows; done += t.rows) {
+        int m = rows - done < t.rows ? (int) (rows - done) : t.rows;
+        for (int c = 0; c < ncols; c++) {
+            double *x = t.cols[c] + window_size;
+            for (int r = 0; r < m; r++) {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                x[r] = (double) (seed >> 11) * 0x1p-53 * 200 - 100;
+            }
+        }
+        memcpy(expected, t.state, ncols * sizeof(double));
+
+        struct timespec t0, t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        sums_scalar(t.cols, check.sums, expected, ncols, window_size, 0, m);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        kernel(t.cols, t.sums, t.state, ncols, window_size, 0, m);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        scalar_ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        kernel_ns += (t2.tv_sec - t1.tv_sec) * 1e9 + (t2.tv_nsec - t1.tv_nsec);
+
+        for (int c = 0; c < ncols && !mismatch; c++) {
+            mismatch = memcmp(check.sums[c], t.sums[c], m * sizeof(double)) != 0;
+        }
+        for (int c = 0; c < ncols; c++) {
+            memmove(t.cols[c], t.cols[c] + m, window_size * sizeof(double));
+        }
+    }
+
+    double values = (double) rows * ncols;
+    printf("%ld rows x %d columns, window %d\n", rows, ncols, window_size);
+    printf("scalar: %8.1f ms  %7.1f M values/s\n", scalar_ns / 1e6, values / scalar_ns * 1e3);
+    printf("%-6s: %8.1f ms  %7.1f M values/s  (x%.2f)\n", kernel == sums_scalar ? "scalar" : "avx2",
+           kernel_ns / 1e6, values / kernel_ns * 1e3, scalar_ns / kernel_ns);
+    if (mismatch) {
+        printf("kernel results differ from the scalar ones!\n");
+    }
+
+    free(expected);
+    table_free(&check);
+    table_free(&t);
+    return mismatch;
+}
+
+// ---- Following a growing file (--follow) ----
+//
+// The file is read to its end once, then inotify tells when it changes and
+// only the bytes added since are read. The rolling state stays in memory,
+// so an update costs as much as the data appended, whatever the file size.
+// A number only counts once whitespace follows it, as the writer may not
+// have finished it yet.
+
+typedef struct {
+    rolling r;
+    writer *out;
+    const int *kinds;
+    int nkinds;         // 0 for the plain average
+    long printed;       // values seen at the last printed average
+} follower;
+
+// Pushes the numbers of [p, end). Returns 0, or -1 at something that isn't a
+// number or when memory runs out.
+static int follow_parse(follower *f, const char *p, const char *end) {
+    for (;;) {
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        if (p == end) {
+            return 0;
+        }
+        double value;
+        const char *stop = parse_number(p, end, &value);
+        if (stop == NULL) {
+            const char *bad = p;
+            while (p < end && !is_space(*p)) {
+                p++;
+            }
+            fprintf(stderr, "Not a number: %.*s\n", (int) (p - bad), bad);
+            return -1;
+        }
+        if (rolling_push(&f->r, value) < 0) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return -1;
+        }
+        if (f->nkinds > 0 && f->r.n >= f->r.values.size) {
+            rolling_print(&f->r, f->out, f->kinds, f->nkinds);
+        }
+        p = stop;
+    }
+}
+
+// Shows what the new data changed, straight away
+static void follow_print(follower *f) {
+    if (f->nkinds > 0) {
+        out_flush(f->out);
+    } else if (f->r.n >= f->r.values.size && f->r.n != f->printed) {
+        printf("%.2f\n", rolling_value(&f->r, SMA));
+        f->printed = f->r.n;
+    }
+    fflush(stdout);
+}
+
+// Prints the average (or --series lines) of the file, then again every time
+// it grows, until it is deleted or renamed. Input that can't be watched,
+// like a pipe, is just read to its end.
+static int run_follow(const char *filename, int window_size, const int *kinds, int nkinds) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening file\n");
+        return 1;
+    }
+
+    // watched before the first read, so nothing appended in between is missed
+    struct stat st;
+    int watch = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        watch = inotify_init1(IN_CLOEXEC);
+        if (watch < 0 || inotify_add_watch(watch, filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF) < 0) {
+            perror("Error watching file");
+            if (watch >= 0) {
+                close(watch);
+            }
+            close(fd);
+            return 1;
+        }
+    }
+
+    follower f = {.kinds = kinds, .nkinds = nkinds};
+    f.out = malloc(sizeof(writer));
+    char *buf = malloc(READ_CHUNK);
+    int status = 1;
+    if (rolling_init(&f.r, window_size) < 0 || !f.out || !buf) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+    f.out->len = 0;
+
+    size_t len = 0;     // unparsed bytes in buf, the start of an unfinished number
+    off_t offset = 0;   // bytes read from the file
+    int gone = 0;
+    for (;;) {
+        ssize_t n = read(fd, buf + len, READ_CHUNK - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error reading file");
+            goto done;
+        }
+        if (n > 0) {
+            len += n;
+            offset += n;
+            size_t complete = len;
+            while (complete > 0 && !is_space(buf[complete - 1])) {
+                complete--;
+            }
+            if (complete == 0 && len == READ_CHUNK) {
+                fprintf(stderr, "Not a number: %.20s...\n", buf);
+                goto done;
+            }
+            if (follow_parse(&f, buf, buf + complete) < 0) {
+                follow_print(&f);   // what came before still counts
+                goto done;
+            }
+            memmove(buf, buf + complete, len - complete);
+            len -= complete;
+            continue;
+        }
+
+        // at the end of what has been written so far
+        if (watch < 0 || gone) {
+            // nothing more is coming, the last number is finished too
+            if (follow_parse(&f, buf, buf + len) < 0) {
+                goto done;
+            }
+            follow_print(&f);
+            break;
+        }
+        follow_print(&f);
+
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t got = read(watch, events, sizeof(events));
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error watching file");
+            goto done;
+        }
+        for (char *e = events; e < events + got; e += sizeof(struct inotify_event) + ((struct inotify_event *) e)->len) {
+            if (((struct inotify_event *) e)->mask & IN_MOVE_SELF) {
+                gone = 1;     // read what is left, then stop
+            }
+        }
+
+        // deleting it only drops the link count while it is still open here
+        if (fstat(fd, &st) == 0 && st.st_nlink == 0) {
+            gone = 1;
+        }
+        // rewritten from the start: the old values mean nothing any more
+        if (st.st_size < offset) {
+            fprintf(stderr, "File truncated, starting over\n");
+            rolling_free(&f.r);
+            if (rolling_init(&f.r, window_size) < 0) {
+                fprintf(stderr, "Memory allocation failed\n");
+                goto done;
+            }
+            f.printed = 0;
+            lseek(fd, 0, SEEK_SET);
+            offset = 0;
+            len = 0;
+        }
+    }
+
+    if (f.r.n < window_size) {
+        fprintf(stderr, "window too large!\n");
+    } else {
+        status = 0;
+    }
+
+done:
+    rolling_free(&f.r);
+    free(f.out);
+    free(buf);
+    if (watch >= 0) {
+        close(watch);
+    }
+    close(fd);
+    return status;
+}
+
+#define USAGE "Usage: ./future <filename> [--window N (default: 50)] [--series [sma,ema,wma,min,max,std]] [--tail] [--threads N] [--columns [LIST]] [--follow]\n" \
+              "       ./future --bench [ROWS [COLUMNS]] [--window N]\n"
 
 int main (int argc, char **argv) {
-    if (argc < 2 || argc > 4) {
-        printf("Usage: ./future <filename> [--window N (default: 50)]\n");
+    if (argc < 2) {
+        printf(USAGE);
         return 1;
     }
 
     int window_size = DEFAULT_window;
+    int kinds[KINDS];
+    int nkinds = 0;
+    int tail = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int columns = 0;
+    int follow = 0;
+    const char *column_list = NULL;
+    int bench = strcmp(argv[1], "--bench") == 0;
+    long bench_rows = 10000000;
+    long bench_columns = 100;
 
-// Mathcing the variables from arguement section 
-    if (argc == 4) {
-       if (strcmp(argv[2], "--window") != 0) {
-            fprintf(stderr, "Usage: ./future <filename> [--window N (default: 50)]\n");
+// Mathcing the variables from arguement section
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window_size = atoi(argv[++i]);
+            if (window_size < 1) {
+                fprintf(stderr, "window too small!\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--series") == 0) {
+            // without a list, every indicator
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                nkinds = parse_kinds(argv[++i], kinds);
+            } else {
+                for (nkinds = 0; nkinds < KINDS; nkinds++) {
+                    kinds[nkinds] = nkinds;
+                }
+            }
+            if (nkinds < 1) {
+                fprintf(stderr, "Unknown series, choose from sma,ema,wma,min,max,std\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tail") == 0) {
+            tail = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            columns = 1;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                column_list = argv[++i];
+            }
+        } else if (bench && i == 2 && argv[i][0] != '-') {
+            bench_rows = atol(argv[i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                bench_columns = atol(argv[++i]);
+            }
+        } else {
+            fprintf(stderr, USAGE);
             return 1;
         }
-        window_size = atoi(argv[3]);
-        if (window_size < 1) {
-            fprintf(stderr, "window too small!\n");
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (tail && nkinds > 0) {
+        fprintf(stderr, "--tail gives the last average only, it can't be used with --series\n");
+        return 1;
+    }
+    if (bench) {
+        if (bench_rows < 1 || bench_columns < 1 || bench_columns > INT32_MAX) {
+            fprintf(stderr, USAGE);
             return 1;
         }
+        return run_bench(bench_rows, (int) bench_columns, window_size);
     }
-// File opening 
-    FILE *file = fopen(argv[1], "r");
-    if (!file) {
-        fprintf(stderr, "Error opening file\n");
+    if (follow) {
+        if (tail || columns) {
+            fprintf(stderr, "--follow can't be used with --tail or --columns\n");
+            return 1;
+        }
+        return run_follow(argv[1], window_size, kinds, nkinds);
+    }
+    if (columns) {
+        if (tail || (nkinds > 0 && (nkinds > 1 || kinds[0] != SMA))) {
+            fprintf(stderr, "--columns gives the last average or --series sma only\n");
+            return 1;
+        }
+        return run_columns(argv[1], window_size, column_list, nkinds > 0);
+    }
+// File opening
+    source src;
+    if (source_open(&src, argv[1], (int) threads) < 0) {
+        if (src.fd < 0) {
+            fprintf(stderr, "Error opening file\n");
+        } else {
+            fprintf(stderr, "Memory allocation failed\n");
+        }
+        source_close(&src);
         return 1;
     }
 
-    double *data = NULL;
-    int capacity = 10;
-    int size = 0;
-    data = malloc(capacity * sizeof(double));
+    if (nkinds > 0) {
+        int status = run_series(&src, window_size, kinds, nkinds);
+        source_close(&src);
+        return status;
+    }
+
+// Only the window is kept in memory, the file is streamed through it
+    ring window = {NULL, window_size, 0, 0, 0};
+    window.cap = window_size < RING_START ? window_size : RING_START;
+    if (tail && src.map != NULL) {
+        window.cap = window_size;
+    }
+    window.values = malloc(window.cap * sizeof(double));
 
 // Here we check  if the memory allocation failled.
-    if (!data) {
+    if (!window.values) {
         fprintf(stderr, "Memory allocation failed\n");
-        fclose(file);
+        source_close(&src);
         return 1;
     }
 
-    double value;
-    while (fscanf(file, "%lf", &value) == 1) {
-        if (size == capacity) {
-            capacity *= 2;
-            data = realloc(data, capacity * sizeof(double));
-            if (!data) {
-                perror("Memory allocation failed");
-                fclose(file);
-                return 1;
+    if (tail && src.map != NULL) {
+        // straight to the end of the file, the window comes out oldest first
+        if (tail_window(&src, window.values, window_size) < 0) {
+            free(window.values);
+            source_close(&src);
+            return 1;
+        }
+        window.count = window_size;
+    } else {
+        const double *values;
+        size_t count;
+        while ((count = source_next(&src, &values)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                if (ring_push(&window, values[i]) < 0) {
+                    perror("Memory allocation failed");
+                    free(window.values);
+                    source_close(&src);
+                    return 1;
+                }
             }
         }
-        data[size] = value; 
-        ++size;
     }
 
-    fclose(file);
-// Check if the window is larger than the size 
-    if (window_size > size) {
+    source_close(&src);
+// Check if the window is larger than the size
+    if (window.count < window_size) {
         fprintf(stderr, "window too large!\n");
-        free(data);
+        free(window.values);
         return 1;
     }
 
-// Calculating moving average of last terms of window
+// Calculating moving average of last terms of window, oldest first
     double sum = 0;
-    for (int i = size - window_size; i < size; i++) {
-        sum += data[i];
+    for (int i = 0; i < window_size; i++) {
+        sum += window.values[(window.head + i) % window_size];
     }
 
     double avg = sum / window_size;
     printf("%.2f\n", avg);
 
-    free(data);
+    free(window.values);
     return 0;
 }
@@ -1,54 +1,268 @@
-#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #define MAXSIZE 256
+#define MAX_FACTORS 64      // a 64-bit number has at most 64 prime factors
+#define TRIAL_LIMIT 4096    // trial division by the primes below this
+#define RHO_BATCH 128       // differences multiplied together before one gcd
 
-int factorize(unsigned long long n) {
-  if (n <= 1) {
+typedef unsigned __int128 u128;
+
+// A small prime with what is needed to test divisibility by a multiply:
+// n is divisible by p exactly when n * inverse (mod 2^64) <= limit
+typedef struct {
+  uint64_t p;
+  uint64_t inverse;
+  uint64_t limit;
+} small_prime;
+
+static small_prime small_primes[TRIAL_LIMIT / 2];
+static int small_count;
+
+// Odd modulus in Montgomery form: values are kept as a * 2^64 mod n
+typedef struct {
+  uint64_t n;
+  uint64_t inverse;   // n^-1 mod 2^64
+  uint64_t r2;        // 2^128 mod n
+  uint64_t one;       // 2^64 mod n
+} montgomery;
+
+// Inverse of an odd number mod 2^64, by Newton's iteration
+static uint64_t inverse_mod_2_64(uint64_t a) {
+  uint64_t x = a;  // right to 3 bits, each step doubles that
+  for (int i = 0; i < 5; i++) {
+    x *= 2 - a * x;
+  }
+  return x;
+}
+
+static void build_small_primes(void) {
+  char composite[TRIAL_LIMIT] = {0};
+  for (int i = 3; i < TRIAL_LIMIT; i += 2) {
+    if (composite[i]) {
+      continue;
+    }
+    for (int j = i * i; j < TRIAL_LIMIT; j += 2 * i) {
+      composite[j] = 1;
+    }
+    small_primes[small_count].p = i;
+    small_primes[small_count].inverse = inverse_mod_2_64(i);
+    small_primes[small_count].limit = UINT64_MAX / i;
+    small_count++;
+  }
+}
+
+static void montgomery_init(montgomery *m, uint64_t n) {
+  m->n = n;
+  m->inverse = inverse_mod_2_64(n);
+  m->one = (0 - n) % n;
+  m->r2 = (u128) m->one * m->one % n;
+}
+
+// t * 2^-64 mod n, for t < n * 2^64
+static inline uint64_t redc(const montgomery *m, u128 t) {
+  uint64_t q = (uint64_t) t * m->inverse;
+  uint64_t high = (uint64_t) (t >> 64);
+  uint64_t sub = (uint64_t) (((u128) q * m->n) >> 64);
+  return high >= sub ? high - sub : high - sub + m->n;
+}
+
+static inline uint64_t mont_mul(const montgomery *m, uint64_t a, uint64_t b) {
+  return redc(m, (u128) a * b);
+}
+
+static inline uint64_t mont_add(const montgomery *m, uint64_t a, uint64_t b) {
+  uint64_t sum = a + b;
+  return sum >= m->n || sum < a ? sum - m->n : sum;
+}
+
+static inline uint64_t to_mont(const montgomery *m, uint64_t a) {
+  return mont_mul(m, a % m->n, m->r2);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  if (a == 0 || b == 0) {
+    return a | b;
+  }
+  int shift = __builtin_ctzll(a | b);
+  a >>= __builtin_ctzll(a);
+  while (b != 0) {
+    b >>= __builtin_ctzll(b);
+    if (a > b) {
+      uint64_t t = a;
+      a = b;
+      b = t;
+    }
+    b -= a;
+  }
+  return a << shift;
+}
+
+// One Miller-Rabin round, n odd: is n a strong probable prime to this base?
+static int strong_probable_prime(const montgomery *m, uint64_t base) {
+  uint64_t n = m->n;
+  base %= n;
+  if (base == 0) {
     return 1;
   }
 
-  char buffer[MAXSIZE];
-  int pos = 0;
-  int count = 0;
+  uint64_t d = n - 1;
+  int s = __builtin_ctzll(d);
+  d >>= s;
 
-  while ((n & 1) == 0) {
-    pos += sprintf(buffer + pos, "2 ");
-    n >>= 1;  
-    count++;
+  uint64_t minus_one = m->n - m->one;
+  uint64_t x = m->one;
+  uint64_t power = to_mont(m, base);
+  while (d > 0) {
+    if (d & 1) {
+      x = mont_mul(m, x, power);
+    }
+    power = mont_mul(m, power, power);
+    d >>= 1;
   }
 
-  while (n % 3 == 0) {
-    pos += sprintf(buffer + pos, "3 ");
-    n /= 3;
-    count++;
+  if (x == m->one || x == minus_one) {
+    return 1;
   }
+  for (int i = 1; i < s; i++) {
+    x = mont_mul(m, x, x);
+    if (x == minus_one) {
+      return 1;
+    }
+  }
+  return 0;
+}
 
-  for (unsigned long long i = 5; i <= sqrt(n); i += 6) {
-    if (n % i == 0) {
-      pos += sprintf(buffer + pos, "%llu ", i);
-      n /= i;
-      count++;
+// Deterministic for every 64-bit n: these seven bases have no common strong
+// pseudoprime below 2^64
+static int is_prime(uint64_t n) {
+  static const uint64_t bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+  if (n < 2) {
+    return 0;
+  }
+  if ((n & 1) == 0) {
+    return n == 2;
+  }
+  if (n < (uint64_t) TRIAL_LIMIT * TRIAL_LIMIT) {
+    // whatever is left after trial division below the limit
+    for (int i = 0; i < small_count && small_primes[i].p * small_primes[i].p <= n; i++) {
+      if (n * small_primes[i].inverse <= small_primes[i].limit) {
+        return 0;
+      }
     }
+    return 1;
+  }
 
-    if (n % (i + 2) == 0) {
-      pos += sprintf(buffer + pos, "%llu ", i + 2);
-      n /= (i + 2);
-      count++;
+  montgomery m;
+  montgomery_init(&m, n);
+  for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+    if (!strong_probable_prime(&m, bases[i])) {
+      return 0;
     }
   }
+  return 1;
+}
 
-  if (n > 1) {
-    pos += sprintf(buffer + pos, "%llu ", n);
-    count++;
+// Pollard's rho with Brent's cycle detection, on an odd composite n.
+// Differences are multiplied together RHO_BATCH at a time so there is one
+// gcd per batch; if a batch overshoots to n, it is stepped through again.
+static uint64_t pollard_brent(uint64_t n) {
+  montgomery m;
+  montgomery_init(&m, n);
+
+  for (uint64_t c = 1;; c++) {
+    uint64_t increment = to_mont(&m, c);
+    uint64_t y = to_mont(&m, 2);
+    uint64_t x = y;
+    uint64_t saved = y;
+    uint64_t product = m.one;
+    uint64_t g = 1;
+
+    for (uint64_t r = 1; g == 1; r <<= 1) {
+      x = y;
+      for (uint64_t i = 0; i < r; i++) {
+        y = mont_add(&m, mont_mul(&m, y, y), increment);
+      }
+      for (uint64_t k = 0; k < r && g == 1; k += RHO_BATCH) {
+        saved = y;
+        uint64_t steps = r - k < RHO_BATCH ? r - k : RHO_BATCH;
+        for (uint64_t i = 0; i < steps; i++) {
+          y = mont_add(&m, mont_mul(&m, y, y), increment);
+          product = mont_mul(&m, product, x > y ? x - y : y - x);
+        }
+        g = gcd(product, n);
+      }
+    }
+
+    if (g == n) {
+      // the batch jumped past the factor: redo it one step at a time
+      do {
+        saved = mont_add(&m, mont_mul(&m, saved, saved), increment);
+        g = gcd(x > saved ? x - saved : saved - x, n);
+      } while (g == 1);
+    }
+    if (g != n) {
+      return g;
+    }
   }
+}
+
+// Adds the prime factors of n to factors[], returns the new count
+static int factor_rest(uint64_t n, uint64_t *factors, int count) {
+  if (n == 1) {
+    return count;
+  }
+  if (is_prime(n)) {
+    factors[count++] = n;
+    return count;
+  }
+  uint64_t d = pollard_brent(n);
+  count = factor_rest(d, factors, count);
+  return factor_rest(n / d, factors, count);
+}
+
+static int compare_factors(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+int factorize(unsigned long long n) {
+  if (n <= 1) {
+    return 1;
+  }
+
+  uint64_t factors[MAX_FACTORS];
+  int count = 0;
+
+  int twos = __builtin_ctzll(n);
+  n >>= twos;
+  while (count < twos) {
+    factors[count++] = 2;
+  }
+
+  for (int i = 0; i < small_count && n > 1; i++) {
+    while (n * small_primes[i].inverse <= small_primes[i].limit) {
+      factors[count++] = small_primes[i].p;
+      n = n * small_primes[i].inverse;  // exact division
+    }
+  }
+
+  count = factor_rest(n, factors, count);
+  qsort(factors, count, sizeof(factors[0]), compare_factors);
 
   if (count != 2) {
     printf("Usage: ./factor <semiprime>\n");
     return 1;
   }
 
+  char buffer[MAXSIZE];
+  int pos = 0;
+  for (int i = 0; i < count; i++) {
+    pos += sprintf(buffer + pos, "%llu ", (unsigned long long) factors[i]);
+  }
+
   buffer[pos] = '\0';
   printf("Factors: %s\n", buffer);
   return 0;
@@ -60,7 +274,9 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  unsigned long long num = atoll(argv[1]); 
+  build_small_primes();
+
+  unsigned long long num = strtoull(argv[1], NULL, 10);
   factorize(num);
   return 0;
-}
\ No newline at end of file
+}